@@ -0,0 +1,278 @@
+/* Copyright (c) 2017 Michael Ammann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAME_PIPE_H
+#define FRAME_PIPE_H
+
+#include "pipe.h"
+
+/** framed pipe, this class stores whole messages as records in a
+    Pipe<char>. Each record is a header followed by the message. The
+    header holds the type and the length of the message encoded the
+    same way as GnssParser::getMessage() returns them (type | length),
+    so a type must not use the lower 16 bits, e.g. GnssParser::NMEA.
+
+    A record is published with a single commit and removed with a single
+    consume, so the reader only ever sees complete messages and finding
+    the next message is O(1). Like Pipe this is a single producer /
+    single consumer object, several reading tasks have to serialise
+    their calls to the reading API (e.g. with a mutex).
+*/
+class FramePipe
+{
+public:
+    enum {
+        HDR       = 4,        //!< size of the record header
+        MAXLEN    = 0xFFFF,   //!< maximum length of a message
+        NONE      = -1        //!< no message available
+    };
+
+    /* Constructor
+        \param n size of the buffer, headers and messages are stored in it
+        \param b optional buffer that should be used.
+                 if NULL the constructor will allocate a buffer of size n.
+    */
+    FramePipe(int n, char* b = NULL) : _pipe(n, b)
+    {
+    }
+
+#ifdef PIPE_LOSSY
+    /** select the lossy mode, put() then removes the oldest messages
+        instead of failing when the pipe is full, so the newest messages
+        are kept. Messages are always removed as a whole.
+        \param on true to enable the lossy mode
+    */
+    void lossy(bool on)
+    {
+        _pipe.lossy(on, _frame);
+    }
+#endif
+
+#ifdef PIPE_STATS
+    /** get the statistics of the underlying pipe, the counters include
+        the record headers
+        \return the statistics
+    */
+    Pipe<char>::Stats stats(void)
+    {
+        return _pipe.stats();
+    }
+#endif
+
+    /** get the length of the longest message that fits into the empty
+        pipe, a longer message can never be added
+        \return the maximum message length
+    */
+    int capacity(void)
+    {
+        int n = _pipe.capacity() - HDR;
+        return (n < 0) ? 0 : (n > MAXLEN) ? MAXLEN : n;
+    }
+
+    // writing thread/context API
+    //-------------------------------------------------------------
+
+    /** Add a message
+        \param type the type of the message
+        \param buf the message
+        \param len the length of the message
+        \return true if added, false if it does not fit into the free space
+    */
+    bool put(int type, const char* buf, int len)
+    {
+        char* p[2];
+        int n[2];
+        if (!_reserve(type, len, p, n))
+            return false;
+        _copy(p, n, HDR, buf, len);
+        _pipe.commit(HDR + len);
+        return true;
+    }
+
+    /** Add a message that is at the read position of a byte pipe and
+        remove it from there, without copying it to a buffer in between.
+        \param type the type of the message
+        \param src the pipe that holds the message
+        \param len the length of the message in src
+        \return true if moved, false if it does not fit into the free space
+    */
+    bool put(int type, Pipe<char>* src, int len)
+    {
+        char* p[2];
+        int n[2];
+        const char* s0;
+        const char* s1;
+        int l0, l1;
+        if ((src->peek(s0, l0, s1, l1) < len) || !_reserve(type, len, p, n))
+            return false;
+        if (l0 > len) l0 = len;
+        _copy(p, n, HDR, s0, l0);
+        _copy(p, n, HDR + l0, s1, len - l0);
+        // a lossy source may have dropped the message while it was copied
+        if (!src->consume(len))
+            return false;
+        _pipe.commit(HDR + len);
+        return true;
+    }
+
+    // reading thread/context API
+    // --------------------------------------------------------
+
+    /** Check if there is a message available
+        \return true if readable
+    */
+    bool readable(void)
+    {
+        return _pipe.readable();
+    }
+
+    /** Get the type and length of the next message without removing it
+        \return type | length of the message, NONE if no message available
+    */
+    int peek(void)
+    {
+        const char* p[2];
+        int n[2];
+        if (!_pipe.peek(p[0], n[0], p[1], n[1]))
+            return NONE;
+        return _header(p[0], n[0], p[1]);
+    }
+
+    /** Get the next message, it is removed from the pipe even if it is
+        longer than the buffer.
+        \param buf the buffer to store it
+        \param len size of the buffer, longer messages are truncated
+        \return type | length of the message (length before truncation),
+                NONE if no message available
+    */
+    int get(char* buf, int len)
+    {
+        int h;
+        do {
+            const char* p[2];
+            int n[2];
+            if (!_pipe.peek(p[0], n[0], p[1], n[1]))
+                return NONE;
+            h = _header(p[0], n[0], p[1]);
+            int l = h & MAXLEN;
+            _read(p, n, HDR, buf, (len > l) ? l : len);
+        } while (!_pipe.consume(HDR + (h & MAXLEN))); // lossy: evicted, retry
+        return h;
+    }
+
+    /** Remove the next message without reading it
+        \return type | length of the removed message, NONE if none available
+    */
+    int drop(void)
+    {
+        int h;
+        do {
+            h = peek();
+            if (h == NONE)
+                return NONE;
+        } while (!_pipe.consume(HDR + (h & MAXLEN))); // lossy: evicted, retry
+        return h;
+    }
+
+protected:
+    /** reserve the space for a record and write its header
+        \param type the type of the message
+        \param len the length of the message
+        \param p set to the regions reserved
+        \param n set to the size of the regions reserved
+        \return true if successful
+    */
+    bool _reserve(int type, int len, char* p[2], int n[2])
+    {
+        if ((len < 0) || (len > MAXLEN) || (type & MAXLEN))
+            return false;
+        if (_pipe.reserve(HDR + len, p[0], n[0], p[1], n[1]) < HDR + len)
+            return false;
+        unsigned int h = (unsigned int) (type | len);
+        char b[HDR] = { (char) h, (char) (h >> 8), (char) (h >> 16), (char) (h >> 24) };
+        _copy(p, n, 0, b, HDR);
+        return true;
+    }
+
+    /** decode a record header
+        \param p0 the first region
+        \param n0 the size of the first region
+        \param p1 the second region
+        \return type | length
+    */
+    static int _header(const char* p0, int n0, const char* p1)
+    {
+        unsigned char h[HDR];
+        for (int i = 0; i < HDR; i ++)
+            h[i] = (i < n0) ? p0[i] : p1[i - n0];
+        return (int) (h[0] | (h[1] << 8) | (h[2] << 16) | ((unsigned) h[3] << 24));
+    }
+
+    /** frame function for the lossy mode, the oldest record is removed
+        \return the size of the oldest record
+    */
+    static int _frame(const char* p0, int n0, const char* p1, int /*n1*/)
+    {
+        return HDR + (_header(p0, n0, p1) & MAXLEN);
+    }
+
+    /** copy data into reserved regions
+        \param p the regions
+        \param n the size of the regions
+        \param o the offset to copy to
+        \param buf the data to copy
+        \param len the length of the data
+    */
+    static void _copy(char* p[2], int n[2], int o, const char* buf, int len)
+    {
+        if (o < n[0]) {
+            int c = n[0] - o;
+            if (c > len) c = len;
+            memcpy(p[0] + o, buf, c);
+            buf += c;
+            len -= c;
+            o += c;
+        }
+        if (len > 0)
+            memcpy(p[1] + o - n[0], buf, len);
+    }
+
+    /** copy data out of the regions returned by peek
+        \param p the regions
+        \param n the size of the regions
+        \param o the offset to copy from
+        \param buf the buffer to copy to
+        \param len the length of the data
+    */
+    static void _read(const char* p[2], int n[2], int o, char* buf, int len)
+    {
+        if (o < n[0]) {
+            int c = n[0] - o;
+            if (c > len) c = len;
+            memcpy(buf, p[0] + o, c);
+            buf += c;
+            len -= c;
+            o += c;
+        }
+        if (len > 0)
+            memcpy(buf, p[1] + o - n[0], len);
+    }
+
+    Pipe<char> _pipe; //!< the pipe holding the records
+};
+
+#endif
+
+// End Of File
@@ -21,13 +21,91 @@
 
 #include "mbed.h"
 #include "ctype.h"
+#include "string.h"
 #include "gnss.h"
 
+// the internal buffers are used whole, a pipe on a buffer that is not a
+// power of two would use less of it
+PIPE_STATIC_ASSERT(!(GNSS_SERIAL_RX_SIZE & (GNSS_SERIAL_RX_SIZE - 1)), "GNSS_SERIAL_RX_SIZE must be a power of two");
+PIPE_STATIC_ASSERT(!(GNSS_SERIAL_TX_SIZE & (GNSS_SERIAL_TX_SIZE - 1)), "GNSS_SERIAL_TX_SIZE must be a power of two");
+PIPE_STATIC_ASSERT(!(GNSS_I2C_RX_SIZE & (GNSS_I2C_RX_SIZE - 1)), "GNSS_I2C_RX_SIZE must be a power of two");
+// the dispatch table is indexed with a mask
+PIPE_STATIC_ASSERT((GNSS_SUBSCRIPTIONS > 1) && !(GNSS_SUBSCRIPTIONS & (GNSS_SUBSCRIPTIONS - 1)),
+                   "GNSS_SUBSCRIPTIONS must be a power of two");
+
+// states of the framing, what the next byte has to be
+enum {
+    FR_SYNC,    // '$' or 0xB5, anything else is unknown
+    FR_NMEA,    // NMEA payload or '*'
+    FR_NMEA_HI, // high nibble of the checksum
+    FR_NMEA_LO, // low nibble of the checksum
+    FR_NMEA_CR, // '\r'
+    FR_NMEA_LF, // '\n'
+    FR_UBX_62,  // the second UBX sync char
+    FR_UBX_CLS, // UBX class, id and length (4 bytes)
+    FR_UBX_ID,
+    FR_UBX_LEN0,
+    FR_UBX_LEN1,
+    FR_UBX_PAY, // UBX payload
+    FR_UBX_CKA, // UBX checksums
+    FR_UBX_CKB,
+    FR_FOUND    // a message was found at s
+};
+
+// the contents of the NMEA fields, see GnssParser::decodeNmea()
+enum {
+    NF_END,     // no more fields of interest
+    NF_SKIP,    // a field that is not decoded
+    NF_TIME,    // hhmmss.ss
+    NF_LAT,     // ddmm.mmmmm
+    NF_NS,      // N or S
+    NF_LON,     // dddmm.mmmmm
+    NF_EW,      // E or W
+    NF_QUALITY, // fix quality
+    NF_SATS,    // satellites used
+    NF_HDOP,
+    NF_ALT,     // altitude in m
+    NF_STATUS,  // A or V
+    NF_SPEED,   // speed in knots
+    NF_COURSE,  // course in degrees
+    NF_DATE,    // ddmmyy
+    NF_MODE,    // navigation mode 1, 2 or 3
+    NF_PDOP,
+    NF_VDOP,
+    NF_DAY,
+    NF_MONTH,
+    NF_YEAR     // yyyy
+};
+
+// the fields of each decoded sentence, starting after the address
+static const unsigned char nmeaGga[] = { NF_TIME, NF_LAT, NF_NS, NF_LON, NF_EW, NF_QUALITY,
+                                         NF_SATS, NF_HDOP, NF_ALT, NF_END };
+static const unsigned char nmeaRmc[] = { NF_TIME, NF_STATUS, NF_LAT, NF_NS, NF_LON, NF_EW,
+                                         NF_SPEED, NF_COURSE, NF_DATE, NF_END };
+static const unsigned char nmeaGll[] = { NF_LAT, NF_NS, NF_LON, NF_EW, NF_TIME, NF_STATUS, NF_END };
+static const unsigned char nmeaVtg[] = { NF_COURSE, NF_SKIP, NF_SKIP, NF_SKIP, NF_SPEED, NF_END };
+static const unsigned char nmeaGsa[] = { NF_SKIP, NF_MODE, NF_SKIP, NF_SKIP, NF_SKIP, NF_SKIP,
+                                         NF_SKIP, NF_SKIP, NF_SKIP, NF_SKIP, NF_SKIP, NF_SKIP,
+                                         NF_SKIP, NF_SKIP, NF_PDOP, NF_HDOP, NF_VDOP, NF_END };
+static const unsigned char nmeaZda[] = { NF_TIME, NF_DAY, NF_MONTH, NF_YEAR, NF_END };
+
 GnssParser::GnssParser(void)
 {
     // Create the power pins but set everything to disabled
     _gnssPower = new DigitalInOut(GNSSPWR, PIN_OUTPUT, OpenDrain, 0);
     _gnssEnable = new DigitalInOut(GNSSEN, PIN_OUTPUT, PushPullNoPull, 0);
+    _fr.pipe = NULL;
+    _fr.ev = 0;
+    _fr.st = FR_SYNC;
+    _fr.o = 0;
+    _fr.s = 0;
+    _fr.next = 0;
+    _fr.a = 0;
+    _fr.b = 0;
+    _fr.n = 0;
+    _fr.type = UNKNOWN;
+    for (int i = 0; i < GNSS_SUBSCRIPTIONS; i ++)
+        _subs[i].key = 0;
 }
 
 GnssParser::~GnssParser(void)
@@ -57,99 +135,433 @@ void GnssParser::_powerOn(void)
 
 int GnssParser::_getMessage(Pipe<char>* pipe, char* buf, int len)
 {
-    int unkn = 0;
+    int ev = pipe->evicted();
+    int ret = _findMessage(pipe, len);
+    if (ret > 0) {
+        pipe->get(buf, LENGTH(ret));
+        _framed(LENGTH(ret));
+        // a lossy pipe may have dropped the message while it was parsed
+        if (ev != pipe->evicted())
+            ret = UNKNOWN | LENGTH(ret);
+    }
+    return ret;
+}
+
+int GnssParser::_peekMessage(Pipe<char>* pipe, Message& msg)
+{
+    int ev = pipe->evicted();
+    // a message is never longer than the pipe holding it
+    int ret = _findMessage(pipe, pipe->capacity());
+    if (ret > 0) {
+        int n = LENGTH(ret);
+        pipe->peek(msg.seg[0].p, msg.seg[0].n, msg.seg[1].p, msg.seg[1].n);
+        if (msg.seg[0].n > n)
+            msg.seg[0].n = n;
+        msg.seg[1].n = n - msg.seg[0].n;
+        // a lossy pipe may have dropped the message while it was parsed
+        if (ev != pipe->evicted())
+            ret = UNKNOWN | n;
+        msg.type = ret;
+        msg.us = 0;
+    }
+    return ret;
+}
+
+bool GnssParser::_releaseMessage(Pipe<char>* pipe, const Message& msg)
+{
+    bool ok = pipe->consume(msg.length());
+    _framed(msg.length());
+    return ok;
+}
+
+int GnssParser::_getMessages(Pipe<char>* pipe, FramePipe* frames)
+{
+    // a longer message can never be added, it is found as unknown data
+    int max = frames->capacity();
+    int ret;
+    int cnt = 0;
+    while ((ret = _findMessage(pipe, max)) > 0) {
+        if (PROTOCOL(ret) == UNKNOWN)
+            _framed(pipe->drop(LENGTH(ret)));
+        else if (frames->put(PROTOCOL(ret), pipe, LENGTH(ret))) {
+            _framed(LENGTH(ret));
+            cnt ++;
+        }
+        else
+            break; // it fits once the reader took messages
+    }
+    return cnt;
+}
+
+int GnssParser::_findMessage(Pipe<char>* pipe, int len)
+{
+    Framer& f = _fr;
     int sz = pipe->size();
     int fr = pipe->free();
-    if (len > sz)
+    bool limited = (len < sz);
+    if (!limited)
         len = sz;
-    while (len > 0)
+    // start over if the pipe changed behind our back
+    if ((f.pipe != pipe) || (f.ev != pipe->evicted()) || (f.o > len)) {
+        f.pipe = pipe;
+        f.ev = pipe->evicted();
+        f.st = FR_SYNC;
+        f.o = 0;
+    }
+    // work on a copy of the state, it is stored back on return
+    int st = f.st;
+    int o = f.o;
+    int a = f.a;
+    int b = f.b;
+    int n = f.n;
+    int s = f.s;
+    int next = f.next;
+    int ret = WAIT;
+    Pipe<char>::Cursor cur(pipe);
+    cur.set(o);
+    for (;;)
     {
-        // NMEA protocol
-        pipe->set(unkn);
-        int nmea = _parseNmea(pipe,len);
-        if ((nmea != NOT_FOUND) && (unkn > 0))  
-            return UNKNOWN | pipe->get(buf,unkn);
-        if (nmea == WAIT && fr)                       
-            return WAIT;
-        if (nmea > 0)                           
-            return NMEA | pipe->get(buf,nmea);
-        // UBX protocol
-        
-        pipe->set(unkn);
-        int ubx = _parseUbx(pipe,len);
-        if ((ubx != NOT_FOUND) && (unkn > 0))   
-            return UNKNOWN | pipe->get(buf,unkn);
-        if (ubx == WAIT && fr)                        
-            return WAIT;
-        if (ubx > 0)                            
-            return UBX | pipe->get(buf,ubx);
-        
-        // UNKNOWN
-        unkn ++;
-        len--;
+        if ((st == FR_SYNC) && (o < len)) {
+            // skip the unknown data up to the next start byte at once
+            const char* p0;
+            const char* p1;
+            int n0, n1;
+            cur.spans(len - o, p0, n0, p1, n1);
+            int k = _findSync(p0, n0);
+            if (k == n0)
+                k += _findSync(p1, n1);
+            o += k;
+            cur.skip(k);
+        }
+        if (st == FR_FOUND) {
+            ret = (s > 0) ? (UNKNOWN | s) : (f.type | o);
+            break;
+        }
+        bool fail = false;
+        if (o >= len) {
+            // all data examined
+            if (st == FR_SYNC) {
+                ret = (o > 0) ? (UNKNOWN | o) : WAIT;
+                break;
+            }
+            if (s > 0) {
+                ret = UNKNOWN | s;
+                break;
+            }
+            if (!limited && fr)
+                break;
+            fail = true; // it does not fit, no more data can complete it
+        }
+        else
+        {
+            int ch = (unsigned char)cur.next();
+            int at = o ++;
+            if (st == FR_SYNC) {
+                if ((ch == '$') || (ch == 0xB5)) {
+                    st = (ch == '$') ? FR_NMEA : FR_UBX_62;
+                    s = at;
+                    next = 0;
+                    a = 0;
+                    b = 0;
+                }
+                continue; // else unknown
+            }
+            // where to continue if this candidate fails
+            if (!next && ((ch == '$') || (ch == 0xB5)))
+                next = at;
+            switch (st) {
+            case FR_NMEA:
+                // the payload in one go, it is the bulk of a sentence
+                for (;;) {
+                    if (ch == '*') {
+                        st = FR_NMEA_HI;
+                        break;
+                    }
+                    if (!isprint(ch)) {
+                        fail = true;
+                        break;
+                    }
+                    a ^= ch;
+                    if (o >= len)
+                        break;
+                    ch = (unsigned char)cur.next();
+                    at = o ++;
+                    if (!next && ((ch == '$') || (ch == 0xB5)))
+                        next = at;
+                }
+                break;
+            case FR_NMEA_HI:
+                fail = (ch != _toHex[(a >> 4) & 0xF]);
+                st = FR_NMEA_LO;
+                break;
+            case FR_NMEA_LO:
+                fail = (ch != _toHex[a & 0xF]);
+                st = FR_NMEA_CR;
+                break;
+            case FR_NMEA_CR:
+                fail = (ch != '\r');
+                st = FR_NMEA_LF;
+                break;
+            case FR_NMEA_LF:
+                fail = (ch != '\n');
+                st = FR_FOUND;
+                f.type = NMEA;
+                break;
+            case FR_UBX_62:
+                fail = (ch != 0x62);
+                st = FR_UBX_CLS;
+                break;
+            case FR_UBX_CLS:
+            case FR_UBX_ID:
+            case FR_UBX_LEN0:
+                a += ch;
+                b += a;
+                n = (st == FR_UBX_LEN0) ? ch : 0;
+                st ++;
+                break;
+            case FR_UBX_LEN1:
+                a += ch;
+                b += a;
+                n += ch << 8;
+                st = n ? FR_UBX_PAY : FR_UBX_CKA;
+                break;
+            case FR_UBX_PAY:
+                // likewise the payload of a message
+                for (;;) {
+                    a += ch;
+                    b += a;
+                    if (!-- n) {
+                        st = FR_UBX_CKA;
+                        break;
+                    }
+                    if (o >= len)
+                        break;
+                    ch = (unsigned char)cur.next();
+                    at = o ++;
+                    if (!next && ((ch == '$') || (ch == 0xB5)))
+                        next = at;
+                }
+                break;
+            case FR_UBX_CKA:
+                fail = (ch != (a & 0xFF));
+                st = FR_UBX_CKB;
+                break;
+            case FR_UBX_CKB:
+                fail = (ch != (b & 0xFF));
+                st = FR_FOUND;
+                f.type = UBX;
+                break;
+            }
+        }
+        if (fail) {
+            // the candidate is unknown data, continue at the next start
+            // byte in it or after it
+            st = FR_SYNC;
+            if (next) {
+                o = next;
+                cur.set(o);
+            }
+        }
     }
-    if (unkn > 0)                      
-        return UNKNOWN | pipe->get(buf,unkn); 
-    return WAIT;
+    f.st = st;
+    f.o = o;
+    f.a = a;
+    f.b = b;
+    f.n = n;
+    f.s = s;
+    f.next = next;
+    return ret;
 }
 
-int GnssParser::_parseNmea(Pipe<char>* pipe, int len)
+int GnssParser::_findSync(const char* p, int n)
 {
     int o = 0;
-    int c = 0;
-    char ch;
-    if (++o > len)                      return WAIT;
-    if ('$' != pipe->next())            return NOT_FOUND;
-    // this needs to be extended by crc checking 
-    for (;;)
-    {
-        if (++o > len)                  return WAIT;
-        ch = pipe->next();
-        if ('*' == ch)                  break; // crc delimiter 
-        if (!isprint(ch))               return NOT_FOUND; 
-        c ^= ch;
-    }
-    if (++o > len)                      return WAIT;
-    ch = _toHex[(c >> 4) & 0xF]; // high nibble
-    if (ch != pipe->next())             return NOT_FOUND;
-    if (++o > len)                      return WAIT;
-    ch = _toHex[(c >> 0) & 0xF]; // low nibble
-    if (ch != pipe->next())             return NOT_FOUND;
-    if (++o > len)                      return WAIT;
-    if ('\r' != pipe->next())           return NOT_FOUND;
-    if (++o > len)                      return WAIT;
-    if ('\n' != pipe->next())           return NOT_FOUND;
+    // byte by byte up to a word boundary
+    while ((o < n) && (((size_t)(p + o)) & (sizeof(unsigned int) - 1))) {
+        if ((p[o] == '$') || (p[o] == (char)0xB5))
+            return o;
+        o ++;
+    }
+    // then a word at a time, a word with a zero byte after the xor with
+    // a start byte in every lane contains that start byte
+    const unsigned int ones = ~0U / 0xFF;
+    const unsigned int highs = ones * 0x80;
+    for (; o + (int)sizeof(unsigned int) <= n; o += sizeof(unsigned int)) {
+        unsigned int w;
+        memcpy(&w, p + o, sizeof(w));
+        unsigned int d = w ^ (ones * '$');
+        unsigned int u = w ^ (ones * 0xB5);
+        if ((((d - ones) & ~d) | ((u - ones) & ~u)) & highs)
+            break;
+    }
+    // the rest and the word with the start byte
+    while ((o < n) && (p[o] != '$') && (p[o] != (char)0xB5))
+        o ++;
     return o;
 }
+        
+void GnssParser::_framed(int n)
+{
+    Framer& f = _fr;
+    if (f.pipe && (f.ev != f.pipe->evicted())) {
+        // dropped by the lossy mode meanwhile
+        f.st = FR_SYNC;
+        f.o = 0;
+    }
+    else if ((f.st != FR_SYNC) && (n <= f.s)) {
+        // the unknown data before the candidate was removed
+        f.o -= n;
+        f.s -= n;
+        if (f.next)
+            f.next -= n;
+    }
+    else if ((f.st == FR_SYNC) && (n < f.o))
+        f.o -= n; // unknown data examined
+    else {
+        f.st = FR_SYNC;
+        f.o = 0;
+    }
+}
 
-int GnssParser::_parseUbx(Pipe<char>* pipe, int l)
+int GnssParser::Message::copy(char* buf, int ix, int len) const
 {
-    int o = 0;
-    if (++o > l)                return WAIT;
-    if ('\xB5' != pipe->next()) return NOT_FOUND;   
-    if (++o > l)                return WAIT;
-    if ('\x62' != pipe->next()) return NOT_FOUND;
-    o += 4;
-    if (o > l)                  return WAIT;
-    int i,j,ca,cb;
-    i = pipe->next(); ca  = i; cb  = ca; // cls
-    i = pipe->next(); ca += i; cb += ca; // id
-    i = pipe->next(); ca += i; cb += ca; // len_lsb
-    j = pipe->next(); ca += j; cb += ca; // len_msb 
-    j = i + (j << 8);
-    while (j--)
-    {
-        if (++o > l)            return WAIT;
-        i = pipe->next(); 
-        ca += i; 
-        cb += ca;
+    int n = 0;
+    for (int i = 0; i < 2; i ++) {
+        int l = seg[i].n - ix;
+        if (l > len - n)
+            l = len - n;
+        if (l > 0) {
+            memcpy(buf + n, seg[i].p + ix, l);
+            n += l;
+            ix = 0;
+        }
+        else
+            ix -= seg[i].n;
     }
-    ca &= 0xFF; cb &= 0xFF;
-    if (++o > l)                return WAIT;
-    if (ca != pipe->next())     return NOT_FOUND;
-    if (++o > l)                return WAIT;
-    if (cb != pipe->next())     return NOT_FOUND;
-    return o;
+    return n;
+}
+
+int GnssParser::peekMessage(Message& msg)
+{
+    (void)msg;
+    return WAIT;
+}
+
+bool GnssParser::releaseMessage(const Message& msg)
+{
+    (void)msg;
+    return false;
+}
+
+bool GnssParser::subscribeNmea(const char* id, Handler handler)
+{
+    return _subscribe(_nmeaKey(id), handler);
+}
+
+bool GnssParser::subscribeUbx(unsigned char cls, unsigned char id, Handler handler)
+{
+    return _subscribe(UBX | (cls << 8) | id, handler);
+}
+
+bool GnssParser::unsubscribeNmea(const char* id)
+{
+    return _unsubscribe(_nmeaKey(id));
+}
+
+bool GnssParser::unsubscribeUbx(unsigned char cls, unsigned char id)
+{
+    return _unsubscribe(UBX | (cls << 8) | id);
+}
+
+int GnssParser::dispatch(void)
+{
+    Message msg;
+    int cnt = 0;
+    while (peekMessage(msg) > 0) {
+        int s = _slot(_key(msg));
+        if ((s >= 0) && _subs[s].key) {
+            // a copy, the handler may change the table
+            Handler handler = _subs[s].handler;
+            handler(msg);
+            cnt ++;
+        }
+        releaseMessage(msg);
+    }
+    return cnt;
+}
+
+int GnssParser::_key(const Message& msg)
+{
+    int n = msg.length();
+    if ((PROTOCOL(msg.type) == NMEA) && (n > 6)) {
+        // the sentence type after the talker, "$GPGGA" or "$PUBX"
+        int o = (msg[1] == 'P') ? 2 : 3;
+        return ((unsigned char)msg[o] << 16) | ((unsigned char)msg[o + 1] << 8) |
+               (unsigned char)msg[o + 2];
+    }
+    if ((PROTOCOL(msg.type) == UBX) && (n >= 8))
+        return UBX | ((unsigned char)msg[2] << 8) | (unsigned char)msg[3];
+    return 0;
+}
+
+int GnssParser::_nmeaKey(const char* id)
+{
+    // exactly three characters, nothing is read past the end
+    if (!id || !id[0] || !id[1] || !id[2] || id[3])
+        return 0;
+    return ((unsigned char)id[0] << 16) | ((unsigned char)id[1] << 8) | (unsigned char)id[2];
+}
+
+int GnssParser::_home(int key)
+{
+    return (int)(((unsigned int)key * 0x9E3779B1U) >> 16) & (GNSS_SUBSCRIPTIONS - 1);
+}
+
+int GnssParser::_slot(int key)
+{
+    const int m = GNSS_SUBSCRIPTIONS - 1;
+    int h = _home(key);
+    for (int i = 0; i <= m; i ++) {
+        int s = (h + i) & m;
+        if (!_subs[s].key || (_subs[s].key == key))
+            return s;
+    }
+    return -1;
+}
+
+bool GnssParser::_subscribe(int key, Handler handler)
+{
+    int s = _slot(key);
+    if (!key || (s < 0))
+        return false;
+    _subs[s].key = key;
+    _subs[s].handler = handler;
+    return true;
+}
+
+bool GnssParser::_unsubscribe(int key)
+{
+    const int m = GNSS_SUBSCRIPTIONS - 1;
+    int s = _slot(key);
+    if (!key || (s < 0) || !_subs[s].key)
+        return false;
+    // move the following entries of the chain into the hole if their home
+    // slot is not between the hole and them, a lookup must not stop early
+    for (int i = (s + 1) & m; _subs[i].key && (i != s); i = (i + 1) & m) {
+        if (((i - _home(_subs[i].key)) & m) >= ((i - s) & m)) {
+            _subs[s] = _subs[i];
+            s = i;
+        }
+    }
+    _subs[s].key = 0;
+    _subs[s].handler = Handler();
+    return true;
+}
+
+int GnssParser::getMessage(char* buf, int len, unsigned int& us)
+{
+    us = 0;
+    return getMessage(buf, len);
 }
 
 int GnssParser::send(const char* buf, int len)
@@ -157,6 +569,14 @@ int GnssParser::send(const char* buf, int len)
     return _send(buf, len);
 }
 
+int GnssParser::_sendv(const Pipe<char>::Seg* seg, int cnt)
+{
+    int sent = 0;
+    for (int i = 0; i < cnt; i ++)
+        sent += _send(seg[i].p, seg[i].n);
+    return sent;
+}
+
 int GnssParser::sendNmea(const char* buf, int len)
 {
     char head[1] = { '$' };
@@ -164,18 +584,16 @@ int GnssParser::sendNmea(const char* buf, int len)
     int i;
     int crc = 0;
     for (i = 0; i < len; i ++)
-        crc ^= *buf++;
-    i  = _send(head, sizeof(head));
-    i += _send(buf, len);
-    tail[1] = _toHex[(crc > 4) & 0xF0];
-    tail[2] = _toHex[(crc > 0) & 0x0F];
-    i += _send(tail, sizeof(tail));
-    return i;
+        crc ^= buf[i];
+    tail[1] = _toHex[(crc >> 4) & 0x0F];
+    tail[2] = _toHex[(crc >> 0) & 0x0F];
+    Pipe<char>::Seg seg[3] = { { head, sizeof(head) }, { buf, len }, { tail, sizeof(tail) } };
+    return _sendv(seg, 3);
 }
 
 int GnssParser::sendUbx(unsigned char cls, unsigned char id, const void* buf /*= NULL*/, int len /*= 0*/)
 {
-    char head[6] = { 0xB5, 0x62, cls, id, (char) len, (char) (len >> 8)};
+    char head[6] = { (char) 0xB5, 0x62, (char) cls, (char) id, (char) len, (char) (len >> 8)};
     char crc[2];
     int i;
     int ca = 0;
@@ -190,12 +608,10 @@ int GnssParser::sendUbx(unsigned char cls, unsigned char id, const void* buf /*=
         ca += ((char*)buf)[i];
         cb += ca; 
     }
-    i  = _send(head, sizeof(head));
-    i += _send(buf, len);
     crc[0] = ca & 0xFF;
     crc[1] = cb & 0xFF;
-    i += _send(crc,  sizeof(crc));
-    return i;
+    Pipe<char>::Seg seg[3] = { { head, sizeof(head) }, { (const char*)buf, len }, { crc, sizeof(crc) } };
+    return _sendv(seg, 3);
 }
 
 const char* GnssParser::findNmeaItemPos(int ix, const char* start, const char* end)
@@ -273,6 +689,206 @@ bool GnssParser::getNmeaAngle(int ix, char* buf, int len, double& val)
     return false;
 }
                 
+bool GnssParser::decodeNmea(const char* buf, int len, NmeaFix& fix)
+{
+    const char* end = &buf[len];
+    if ((len < 7) || (buf[0] != '$'))
+        return false;
+    // the sentence type after the talker
+    const char* p = &buf[(buf[1] == 'P') ? 2 : 3];
+    const unsigned char* fields;
+    if      (!memcmp(p, "GGA", 3)) fields = nmeaGga;
+    else if (!memcmp(p, "RMC", 3)) fields = nmeaRmc;
+    else if (!memcmp(p, "GLL", 3)) fields = nmeaGll;
+    else if (!memcmp(p, "VTG", 3)) fields = nmeaVtg;
+    else if (!memcmp(p, "GSA", 3)) fields = nmeaGsa;
+    else if (!memcmp(p, "ZDA", 3)) fields = nmeaZda;
+    else return false;
+    p += 3;
+    // walk the fields once, the position is only taken if it is complete
+    double lat = 0, lon = 0;
+    int pos = 0;
+    int day = -1, month = -1;
+    // the dilutions are only taken if all three of GSA are there
+    double pdop = 0, vdop = 0;
+    int dop = 0;
+    for (; *fields != NF_END; fields ++) {
+        if ((p >= end) || (*p != ','))
+            break; // the sentence ends early
+        const char* f = ++ p;
+        while ((p < end) && (*p != ',') && (*p != '*'))
+            p ++;
+        int n = (int)(p - f);
+        if (n == 0)
+            continue; // empty
+        double val;
+        int i;
+        switch (*fields) {
+        case NF_TIME:
+            if ((n >= 6) && ((i = _digits(f, 6)) >= 0)) {
+                fix.ms = ((i / 10000) * 3600 + (i / 100 % 100) * 60 + (i % 100)) * 1000;
+                // up to milliseconds of the fraction
+                for (int x = 7, s = 100; (x < n) && (f[6] == '.') && (s > 0) &&
+                                         (f[x] >= '0') && (f[x] <= '9'); x ++, s /= 10)
+                    fix.ms += (f[x] - '0') * s;
+                fix.fields |= FIX_TIME;
+            }
+            break;
+        case NF_LAT:
+        case NF_LON:
+            if (_decimal(f, p, val)) {
+                // ddmm.mmmm to degrees
+                int d = (int)(val * 0.01);
+                val = d + (val - d * 100) / 60;
+                if (*fields == NF_LAT)
+                    lat = val;
+                else
+                    lon = val;
+                pos |= (*fields == NF_LAT) ? 1 : 4;
+            }
+            break;
+        case NF_NS:
+        case NF_EW:
+            if ((*f == 'S') || (*f == 'W')) {
+                lat = (*f == 'S') ? -lat : lat;
+                lon = (*f == 'W') ? -lon : lon;
+            }
+            if ((*f == 'N') || (*f == 'S') || (*f == 'E') || (*f == 'W'))
+                pos |= (*fields == NF_NS) ? 2 : 8;
+            break;
+        case NF_QUALITY:
+            if ((fix.quality = _digits(f, n)) >= 0)
+                fix.fields |= FIX_QUALITY;
+            break;
+        case NF_SATS:
+            if ((fix.sats = _digits(f, n)) >= 0)
+                fix.fields |= FIX_SATS;
+            break;
+        case NF_HDOP:
+            if (_decimal(f, p, fix.hdop)) {
+                fix.fields |= FIX_HDOP;
+                dop |= 2;
+            }
+            break;
+        case NF_ALT:
+            if (_decimal(f, p, fix.alt))
+                fix.fields |= FIX_ALT;
+            break;
+        case NF_STATUS:
+            fix.status = *f;
+            fix.fields |= FIX_STATUS;
+            break;
+        case NF_SPEED:
+            if (_decimal(f, p, fix.speed))
+                fix.fields |= FIX_SPEED;
+            break;
+        case NF_COURSE:
+            if (_decimal(f, p, fix.course))
+                fix.fields |= FIX_COURSE;
+            break;
+        case NF_DATE:
+            if ((n == 6) && ((i = _digits(f, 6)) >= 0)) {
+                fix.day = i / 10000;
+                fix.month = i / 100 % 100;
+                fix.year = 2000 + i % 100;
+                fix.fields |= FIX_DATE;
+            }
+            break;
+        case NF_MODE:
+            if ((fix.navMode = _digits(f, n)) >= 0)
+                fix.fields |= FIX_MODE;
+            break;
+        case NF_PDOP:
+            if (_decimal(f, p, pdop))
+                dop |= 1;
+            break;
+        case NF_VDOP:
+            if (_decimal(f, p, vdop))
+                dop |= 4;
+            break;
+        case NF_DAY:
+            day = _digits(f, n);
+            break;
+        case NF_MONTH:
+            month = _digits(f, n);
+            break;
+        case NF_YEAR:
+            if ((day > 0) && (month > 0) && ((i = _digits(f, n)) > 0)) {
+                fix.day = day;
+                fix.month = month;
+                fix.year = i;
+                fix.fields |= FIX_DATE;
+            }
+            break;
+        }
+    }
+    if (pos == 15) {
+        fix.lat = lat;
+        fix.lon = lon;
+        fix.fields |= FIX_POS;
+    }
+    if (dop == 7) {
+        fix.pdop = pdop;
+        fix.vdop = vdop;
+        fix.fields |= FIX_DOP;
+    }
+    return true;
+}
+
+bool GnssParser::decodeNmea(const Message& msg, NmeaFix& fix)
+{
+    if (PROTOCOL(msg.type) != NMEA)
+        return false;
+    if (!msg.seg[1].n)
+        return decodeNmea(msg.seg[0].p, msg.seg[0].n, fix);
+    // it wraps, a sentence has at most 82 characters
+    char buf[128];
+    int n = msg.copy(buf, 0, sizeof(buf));
+    return decodeNmea(buf, n, fix);
+}
+
+bool GnssParser::_decimal(const char* p, const char* end, double& val)
+{
+    bool neg = (p < end) && (*p == '-');
+    const char* s = neg ? p + 1 : p;
+    // the integer part and the fraction as integers, so that the
+    // conversion is exact up to the rounding of the division
+    unsigned long ip = 0;
+    unsigned long fp = 0;
+    unsigned long div = 1;
+    for (p = s; (p < end) && (*p >= '0') && (*p <= '9'); p ++)
+        ip = ip * 10 + (*p - '0');
+    bool digits = (p > s);
+    if ((p < end) && (*p == '.')) {
+        for (p ++; (p < end) && (*p >= '0') && (*p <= '9') && (div < 100000000UL); p ++) {
+            fp = fp * 10 + (*p - '0');
+            div *= 10;
+            digits = true;
+        }
+        while ((p < end) && (*p >= '0') && (*p <= '9'))
+            p ++; // beyond the precision
+    }
+    if (!digits || (p != end))
+        return false;
+    val = (double)ip + (double)fp / div;
+    if (neg)
+        val = -val;
+    return true;
+}
+
+int GnssParser::_digits(const char* p, int n)
+{
+    int val = 0;
+    if (n <= 0 || n > 9)
+        return -1;
+    for (; n > 0; n --, p ++) {
+        if ((*p < '0') || (*p > '9'))
+            return -1;
+        val = val * 10 + (*p - '0');
+    }
+    return val;
+}
+
 const char GnssParser::_toHex[] = { '0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F' };
 
 // ----------------------------------------------------------------
@@ -280,8 +896,15 @@ const char GnssParser::_toHex[] = { '0','1','2','3','4','5','6','7','8','9','A',
 // ----------------------------------------------------------------
 
 GnssSerial::GnssSerial(PinName tx /*= GNSSTXD  */, PinName rx /*= GNSSRXD */, int baudrate /*= GNSSBAUD */,
-            int rxSize /*= 256 */, int txSize /*= 128 */) :
-            SerialPipe(tx, rx, baudrate, rxSize, txSize)
+            int rxSize /*= GNSS_SERIAL_RX_SIZE */, int txSize /*= GNSS_SERIAL_TX_SIZE */) :
+            // the whole internal buffer if the size asked for fits, Pipe
+            // would round a smaller size down to a power of two
+            SerialPipe(tx, rx, baudrate,
+                       (rxSize <= (int)sizeof(_rxBuf)) ? (int)sizeof(_rxBuf) : rxSize,
+                       (txSize <= (int)sizeof(_txBuf)) ? (int)sizeof(_txBuf) : txSize,
+                       (rxSize <= (int)sizeof(_rxBuf)) ? _rxBuf : NULL,
+                       (txSize <= (int)sizeof(_txBuf)) ? _txBuf : NULL),
+            _termPos(0), _termLen(0), _baudrate(baudrate), _probeMs(0)
 {
     baud(baudrate);
 }
@@ -298,6 +921,8 @@ bool GnssSerial::init(PinName pn)
 
     // send a byte to wakup the device again
     putc(0xFF);
+    if (_probeMs)
+        return detectBaudrate(_probeMs);
     // wait until we get some bytes
     int size = _pipeRx.size();
     Timer timer;
@@ -309,22 +934,262 @@ bool GnssSerial::init(PinName pn)
 
 int GnssSerial::getMessage(char* buf, int len)
 {
-    return _getMessage(&_pipeRx, buf, len);   
+    unsigned int us;
+    return getMessage(buf, len, us);
+}
+
+int GnssSerial::getMessage(char* buf, int len, unsigned int& us)
+{
+    // the message starts at the next byte to read
+    unsigned int pos = rxPos();
+    int ret = _getMessage(&_pipeRx, buf, len);
+    if ((ret <= 0) || (PROTOCOL(ret) == UNKNOWN) || !rxStamp(pos, us))
+        us = 0;
+    return ret;
 }
 
+int GnssSerial::peekMessage(Message& msg)
+{
+    unsigned int pos = rxPos();
+    int ret = _peekMessage(&_pipeRx, msg);
+    if ((ret > 0) && (PROTOCOL(ret) != UNKNOWN) && !rxStamp(pos, msg.us))
+        msg.us = 0;
+    return ret;
+}
+
+bool GnssSerial::releaseMessage(const Message& msg)
+{
+    return _releaseMessage(&_pipeRx, msg);
+}
+
+void GnssSerial::timestamps(bool on)
+{
+    rxStamps(on ? GNSS_SERIAL_STAMPS : 0, "$\xB5");
+}
+
+int GnssSerial::getMessages(FramePipe* frames)
+{
+    return _getMessages(&_pipeRx, frames);
+}
+
+bool GnssSerial::setBaudrate(int baudrate, int ms)
+{
+    char cfg[20];
+    int old = _baudrate;
+    if (!_pollPort(cfg, ms))
+        return false; // no answer at the current rate
+    if (baudrate == old)
+        return true;
+    if (!_setPort(cfg, baudrate))
+        return false; // the command is not out, the receiver did not switch
+    if (_pollPort(cfg, ms))
+        return true;
+    // the receiver is silent at the new rate, tell it to go back in case
+    // it switched and go back too
+    _setPort(cfg, old);
+    _pollPort(cfg, ms);
+    return false;
+}
+
+int GnssSerial::getBaudrate(void)
+{
+    return _baudrate;
+}
+
+bool GnssSerial::_pollPort(char* cfg, int ms)
+{
+    // large enough for any NMEA sentence (82 characters), so that these
+    // are framed as such and not as unknown data
+    char buf[128];
+    const char port = 1; // UART1
+    Timer timer;
+    timer.start();
+    sendUbx(0x06, 0x00, &port, sizeof(port));
+    while (timer.read_ms() < ms)
+    {
+        int ret = getMessage(buf, sizeof(buf));
+        if ((ret > 0) && (ret == (UBX | (6 + 20 + 2))) &&
+            (buf[2] == 0x06) && (buf[3] == 0x00) && (buf[6] == port)) {
+            memcpy(cfg, buf + 6, 20);
+            return true;
+        }
+        if (ret <= 0)
+            wait_ms(1);
+    }
+    return false;
+}
+
+bool GnssSerial::_setPort(char* cfg, int baudrate)
+{
+    // the baud rate is a little endian U4 at offset 8
+    cfg[ 8] = (char) baudrate;
+    cfg[ 9] = (char) (baudrate >> 8);
+    cfg[10] = (char) (baudrate >> 16);
+    cfg[11] = (char) (baudrate >> 24);
+    sendUbx(0x06, 0x00, cfg, 20);
+    // the receiver switches after the command
+    return _switch(baudrate);
+}
+
+bool GnssSerial::_switch(int baudrate)
+{
+    // let the UART send everything out, a full transmit buffer takes
+    // its byte times, a stalled transmitter is given up on
+    int ms = GNSS_BAUD_TIMEOUT_MS + (int)((_pipeTx.capacity() * 10 * 1000LL) / _baudrate);
+    Timer timer;
+    timer.start();
+    while (!txEmpty()) {
+        if (timer.read_ms() >= ms)
+            return false;
+        wait_ms(1);
+    }
+    // about 32 byte times for the FIFO and shift register of the UART
+    wait_ms(1 + (32 * 10 * 1000) / _baudrate);
+    baud(baudrate);
+    _baudrate = baudrate;
+    // drop what was received around the switch
+    _framed(_pipeRx.drop(_pipeRx.size()));
+    return true;
+}
+
+void GnssSerial::autoBaud(bool on, int ms)
+{
+    _probeMs = on ? ms : 0;
+}
+
+bool GnssSerial::detectBaudrate(int ms)
+{
+    static const int rates[] = { GNSS_BAUD_RATES };
+    int start = _baudrate;
+    Timer timer;
+    timer.start();
+    // the current rate first, it is the most likely one
+    for (int i = -1; i < (int)(sizeof(rates) / sizeof(*rates)); i ++)
+    {
+        int left = GNSS_BAUD_DETECT_MS - timer.read_ms();
+        if (left <= 0)
+            break; // time limit over all rates
+        if (i >= 0) {
+            if (rates[i] == start)
+                continue;
+            if (!_switch(rates[i]))
+                return false; // the transmitter is stalled
+        }
+        if (_probe((ms < left) ? ms : left))
+            return true;
+    }
+    if (_baudrate != start)
+        _switch(start);
+    return false;
+}
+
+bool GnssSerial::_probe(int ms)
+{
+    const char port = 1; // UART1
+    int valid = 0;
+    int unknown = 0;
+    int frames = 0;
+    int polled = -GNSS_BAUD_POLL_MS;
+    Timer timer;
+    timer.start();
+    while (timer.read_ms() < ms)
+    {
+        // the answer to a poll comes at once, repeated in case the first
+        // one was lost in the switch
+        if (timer.read_ms() - polled >= GNSS_BAUD_POLL_MS) {
+            polled = timer.read_ms();
+            sendUbx(0x06, 0x00, &port, sizeof(port));
+        }
+        int ret = _findMessage(&_pipeRx, _pipeRx.size());
+        if (ret > 0) {
+            _framed(_pipeRx.drop(LENGTH(ret)));
+            if (PROTOCOL(ret) == UNKNOWN)
+                unknown += LENGTH(ret);
+            else {
+                valid += LENGTH(ret);
+                frames ++;
+            }
+            if ((frames >= 2) && (valid > unknown))
+                return true;
+        }
+        else
+            wait_ms(1);
+    }
+    // the first message may have been cut by the switch
+    return (frames > 0) && (2 * valid > unknown);
+}
+
+void GnssSerial::messageSignal(PipeSignal* sig)
+{
+    rxSignal(NULL);
+    _termPos = 0;
+    rxSignal(sig, callback(this, &GnssSerial::_terminator));
+}
+
+bool GnssSerial::_terminator(char ch)
+{
+    // follow a UBX message by its length: sync chars, class, id,
+    // 2 bytes length, payload and 2 bytes checksum
+    if (_termPos == 0) {
+        if (ch == '\xB5')
+            _termPos = 1;
+        return (ch == '\n'); // end of a NMEA line
+    }
+    if ((_termPos == 1) && (ch != 0x62)) {
+        _termPos = 0;
+        return (ch == '\n');
+    }
+    if (_termPos == 4)
+        _termLen = (unsigned char)ch;
+    else if (_termPos == 5) {
+        _termLen += 8 + ((unsigned char)ch << 8);
+        if (_termLen > _pipeRx.capacity())
+            _termPos = -1; // too large for the buffer, resync
+    }
+    if ((++ _termPos > 6) && (_termPos == _termLen)) {
+        _termPos = 0;
+        return true;
+    }
+    return false;
+}
+
+#ifdef PIPE_LOSSY
+void GnssSerial::lossy(bool on)
+{
+    _pipeRx.lossy(on, _frame);
+}
+
+int GnssSerial::_frame(const char* p0, int n0, const char* p1, int n1)
+{
+    // the oldest frame ends where the next NMEA or UBX message may start
+    for (int i = 1; i < n0 + n1; i ++) {
+        char ch = (i < n0) ? p0[i] : p1[i - n0];
+        if ((ch == '$') || (ch == '\xB5'))
+            return i;
+    }
+    return n0 + n1;
+}
+#endif
+
 int GnssSerial::_send(const void* buf, int len)
 { 
     return put((const char*)buf, len, true/*=blocking*/); 
 }
 
+int GnssSerial::_sendv(const Pipe<char>::Seg* seg, int cnt)
+{
+    return put(seg, cnt, true/*=blocking*/);
+}
+
 // ----------------------------------------------------------------
 // I2C Implementation 
 // ----------------------------------------------------------------
 
 GnssI2C::GnssI2C(PinName sda /*= NC */, PinName scl /*= NC */,
-               unsigned char i2cAdr /*= (66<<1) */, int rxSize /*= 256 */) :
+               unsigned char i2cAdr /*= (66<<1) */, int rxSize /*= GNSS_I2C_RX_SIZE */) :
                I2C(sda,scl),
-               _pipe(rxSize),
+               _pipe((rxSize <= (int)sizeof(_buf)) ? (int)sizeof(_buf) : rxSize,
+                     (rxSize <= (int)sizeof(_buf)) ? _buf : NULL),
                _i2cAdr(i2cAdr)
 {
     frequency(100000);
@@ -351,16 +1216,35 @@ bool GnssI2C::init(PinName pn)
 
 int GnssI2C::getMessage(char* buf, int len)
 {
-    // fill the pipe
-    int sz = _pipe.free();
-    if (sz) 
-        sz = _get(buf, sz);
-    if (sz) 
-        _pipe.put(buf, sz);
+    _fill();
     // now parse it
     return _getMessage(&_pipe, buf, len);   
 }
 
+int GnssI2C::peekMessage(Message& msg)
+{
+    _fill();
+    return _peekMessage(&_pipe, msg);
+}
+
+bool GnssI2C::releaseMessage(const Message& msg)
+{
+    return _releaseMessage(&_pipe, msg);
+}
+
+int GnssI2C::getMessages(FramePipe* frames)
+{
+    _fill();
+    return _getMessages(&_pipe, frames);
+}
+
+#ifdef PIPE_STATS
+Pipe<char>::Stats GnssI2C::rxStats(void)
+{
+    return _pipe.stats();
+}
+#endif
+
 int GnssI2C::send(const char* buf, int len)
 {
     int sent = 0;
@@ -391,6 +1275,21 @@ int GnssI2C::sendUbx(unsigned char cls, unsigned char id, const void* buf, int l
     return sent;
 }
 
+void GnssI2C::_fill(void)
+{
+    // fill the pipe, reading directly into the free space
+    char* p0;
+    char* p1;
+    int n0, n1;
+    if (_pipe.reserve(_pipe.free(), p0, n0, p1, n1))
+    {
+        int sz = _get(p0, n0);
+        if ((sz == n0) && n1)
+            sz += _get(p1, n1);
+        _pipe.commit(sz);
+    }
+}
+
 int GnssI2C::_get(char* buf, int len)
 {
     int read = 0;
@@ -24,6 +24,7 @@
 
 #include "mbed.h"
 #include "pipe.h"
+#include "frame_pipe.h"
 #include "serial_pipe.h"
 
 #ifdef TARGET_UBLOX_C030
@@ -32,6 +33,39 @@
  #define GNSS_IF(onboard, shield) shield
 #endif
 
+// size of the buffers held inside the GNSS objects, these must be a power
+// of two, a larger size passed to a constructor is allocated from the heap
+#ifndef GNSS_SERIAL_RX_SIZE
+ #define GNSS_SERIAL_RX_SIZE 256 //!< default serial rx buffer size
+#endif
+#ifndef GNSS_SERIAL_TX_SIZE
+ #define GNSS_SERIAL_TX_SIZE 128 //!< default serial tx buffer size
+#endif
+#ifndef GNSS_I2C_RX_SIZE
+ #define GNSS_I2C_RX_SIZE    256 //!< default i2c rx buffer size
+#endif
+#ifndef GNSS_SERIAL_STAMPS
+ #define GNSS_SERIAL_STAMPS  16  //!< receive timestamps kept, see GnssSerial::timestamps()
+#endif
+#ifndef GNSS_BAUD_TIMEOUT_MS
+ #define GNSS_BAUD_TIMEOUT_MS 1000 //!< time the receiver has to answer, see GnssSerial::setBaudrate()
+#endif
+#ifndef GNSS_BAUD_RATES
+ #define GNSS_BAUD_RATES 9600, 115200, 38400, 460800, 230400, 57600, 19200, 4800 //!< rates probed by GnssSerial::detectBaudrate()
+#endif
+#ifndef GNSS_BAUD_PROBE_MS
+ #define GNSS_BAUD_PROBE_MS 300 //!< time listened at each rate, the receiver is polled meanwhile
+#endif
+#ifndef GNSS_BAUD_POLL_MS
+ #define GNSS_BAUD_POLL_MS 100 //!< interval of the polls while a rate is probed
+#endif
+#ifndef GNSS_BAUD_DETECT_MS
+ #define GNSS_BAUD_DETECT_MS 3000 //!< time limit of GnssSerial::detectBaudrate() over all rates
+#endif
+#ifndef GNSS_SUBSCRIPTIONS
+ #define GNSS_SUBSCRIPTIONS 16 //!< size of the dispatch table, a power of two, see GnssParser::subscribeNmea()
+#endif
+
 /** basic GNSS parser class
 */
 class GnssParser
@@ -68,7 +102,111 @@ public:
                 NOT_FOUND if nothing was found
     */ 
     virtual int getMessage(char* buf, int len) = 0;
+
+    /** Get a line from the physical interface together with the time
+        its first byte was received.
+        \param buf the buffer to store it
+        \param len size of the buffer
+        \param us set to the receive time in microseconds (see
+               PIPE_CLOCK_US()), 0 if the interface does not record it
+        \return same as getMessage(buf, len)
+    */
+    virtual int getMessage(char* buf, int len, unsigned int& us);
     
+    /** a message in place in the receive buffer, see peekMessage(). The
+        bytes are in up to two regions, the second one is only used if
+        the message wraps at the end of the buffer.
+    */
+    struct Message {
+        int type;               //!< type and length, as returned by getMessage()
+        Pipe<char>::Seg seg[2]; //!< the regions of the message
+        unsigned int us;        //!< receive time of the first byte, 0 if not known
+
+        /** get the length of the message
+            \return the number of bytes
+        */
+        int length(void) const
+        {
+            return LENGTH(type);
+        }
+
+        /** get a byte of the message
+            \param ix the index of the byte, 0 is the first byte
+            \return the byte
+        */
+        char operator[](int ix) const
+        {
+            return (ix < seg[0].n) ? seg[0].p[ix] : seg[1].p[ix - seg[0].n];
+        }
+
+        /** copy a part of the message, e.g. a field to convert
+            \param buf the buffer to store it
+            \param ix the index of the first byte to copy
+            \param len the number of bytes to copy
+            \return the number of bytes copied, less if the message ends
+        */
+        int copy(char* buf, int ix, int len) const;
+    };
+
+    /** Get the next message in place, without copying it out of the
+        receive buffer. It stays there, and is returned again, until it
+        is released with releaseMessage(); no other message can be taken
+        meanwhile. As no buffer of the caller limits the length, only a
+        message that does not fit into the receive buffer is unknown data.
+        \param msg set to the message if something was found
+        \return same as getMessage(buf, len)
+    */
+    virtual int peekMessage(Message& msg);
+
+    /** Remove a message returned by peekMessage() from the receive buffer.
+        \param msg the message
+        \return true if done, false if the lossy mode dropped the message
+                while it was in use, what was read from it is invalid
+    */
+    virtual bool releaseMessage(const Message& msg);
+
+    //! a message handler, see subscribeNmea() and subscribeUbx()
+    typedef Callback<void(const Message&)> Handler;
+
+    /** Call a handler from dispatch() for a NMEA sentence type from any
+        talker, e.g. "GGA" for $GPGGA and $GNGGA, or "UBX" for $PUBX.
+        \param id the three characters of the sentence type
+        \param handler the handler, it replaces a previous one
+        \return true if done, false if the dispatch table is full or id
+                is not a string of three characters
+    */
+    bool subscribeNmea(const char* id, Handler handler);
+
+    /** Call a handler from dispatch() for a UBX message.
+        \param cls the UBX class id
+        \param id the UBX message id
+        \param handler the handler, it replaces a previous one
+        \return true if done, false if the dispatch table is full
+    */
+    bool subscribeUbx(unsigned char cls, unsigned char id, Handler handler);
+
+    /** Remove the handler of a NMEA sentence type.
+        \param id the three characters of the sentence type
+        \return true if done, false if there is none or id is not a
+                string of three characters
+    */
+    bool unsubscribeNmea(const char* id);
+
+    /** Remove the handler of a UBX message.
+        \param cls the UBX class id
+        \param id the UBX message id
+        \return true if done, false if there is none
+    */
+    bool unsubscribeUbx(unsigned char cls, unsigned char id);
+
+    /** Take all available messages and pass each one to its handler, in
+        place (see peekMessage()). The handler is found with a single
+        lookup in a table, messages without one are dropped undecoded.
+        A handler must not take messages itself.
+        \return the number of messages passed to a handler
+    */
+    int dispatch(void);
+
     /** send a buffer
         \param buf the buffer to write
         \param len size of the buffer to write
@@ -145,6 +283,65 @@ public:
     */
     static bool getNmeaAngle(int ix, char* buf, int len, double& val);
     
+    //! the fields of a NmeaFix set by decodeNmea()
+    enum {
+        FIX_TIME    = 0x001, //!< ms, from GGA, RMC, GLL or ZDA
+        FIX_POS     = 0x002, //!< lat and lon, from GGA, RMC or GLL
+        FIX_QUALITY = 0x004, //!< quality, from GGA
+        FIX_SATS    = 0x008, //!< sats, from GGA
+        FIX_HDOP    = 0x010, //!< hdop, from GGA or GSA
+        FIX_ALT     = 0x020, //!< alt, from GGA
+        FIX_SPEED   = 0x040, //!< speed, from RMC or VTG
+        FIX_COURSE  = 0x080, //!< course, from RMC or VTG
+        FIX_DATE    = 0x100, //!< day, month and year, from RMC or ZDA
+        FIX_STATUS  = 0x200, //!< status, from RMC or GLL
+        FIX_MODE    = 0x400, //!< navMode, from GSA
+        FIX_DOP     = 0x800  //!< pdop and vdop, from a GSA with all three dilutions
+    };
+
+    /** the navigation data of the NMEA sentences of an epoch, see
+        decodeNmea(). Only the fields in fields are valid.
+    */
+    struct NmeaFix {
+        int fields;     //!< the fields set, FIX_TIME | FIX_POS | ...
+        int ms;         //!< UTC time of day in milliseconds
+        double lat;     //!< latitude in degrees, south is negative
+        double lon;     //!< longitude in degrees, west is negative
+        int quality;    //!< fix quality: 0 none, 1 GNSS, 2 DGNSS, 4 RTK fixed, 5 RTK float, 6 dead reckoning
+        int sats;       //!< number of satellites used
+        double hdop;    //!< horizontal dilution of precision
+        double alt;     //!< altitude above mean sea level in m
+        double speed;   //!< speed over ground in knots
+        double course;  //!< course over ground in degrees (true)
+        int day;        //!< UTC day of the month
+        int month;      //!< UTC month, 1 to 12
+        int year;       //!< UTC year, e.g. 2017
+        char status;    //!< 'A' valid, 'V' invalid
+        int navMode;    //!< 1 no fix, 2 2D fix, 3 3D fix
+        double pdop;    //!< position dilution of precision
+        double vdop;    //!< vertical dilution of precision
+    };
+
+    /** Decode a GGA, RMC, GLL, VTG, GSA or ZDA sentence of any talker
+        into a fix. The sentence is walked once, field by field, instead
+        of looking up each field from its start as getNmeaItem() does.
+        The fields found are added to fix, so the sentences of an epoch
+        can be collected by clearing fix.fields once per epoch.
+        \param buf the NMEA message, as returned by getMessage()
+        \param len the size of the NMEA message
+        \param fix the fix the fields are stored to
+        \return true if the sentence is one of the decoded types
+    */
+    static bool decodeNmea(const char* buf, int len, NmeaFix& fix);
+
+    /** Decode a NMEA message returned by peekMessage(), e.g. from a
+        handler of dispatch(), see decodeNmea(buf, len, fix).
+        \param msg the NMEA message
+        \param fix the fix the fields are stored to
+        \return true if the sentence is one of the decoded types
+    */
+    static bool decodeNmea(const Message& msg, NmeaFix& fix);
+
 protected:
     /** Power on the GNSS module.
     */
@@ -158,26 +355,117 @@ protected:
                 WAIT if not enough data is available
                 NOT_FOUND if nothing was found
     */ 
-    static int _getMessage(Pipe<char>* pipe, char* buf, int len);
-    
-    /** Check if the current offset of the pipe contains a NMEA message.
-        \param pipe the receiveing pipe to parse messages 
-        \param len numer of bytes to parse at maximum
-        \return length if something was found (including the NMEA frame) 
+    int _getMessage(Pipe<char>* pipe, char* buf, int len);
+
+    /** Get the next message in place, see peekMessage().
+        \param pipe the receiveing pipe to parse messages
+        \param msg set to the message if something was found
+        \return type and length if something was found,
                 WAIT if not enough data is available
-                NOT_FOUND if nothing was found
-    */ 
-    static int _parseNmea(Pipe<char>* pipe, int len);
+    */
+    int _peekMessage(Pipe<char>* pipe, Message& msg);
+
+    /** Remove a message returned by _peekMessage().
+        \param pipe the receiveing pipe
+        \param msg the message
+        \return true if done, false if it was dropped meanwhile
+    */
+    bool _releaseMessage(Pipe<char>* pipe, const Message& msg);
     
-    /** Check if the current offset of the pipe contains a UBX message.
-        \param pipe the receiveing pipe to parse messages 
-        \param len numer of bytes to parse at maximum
-        \return length if something was found (including the UBX frame)
+    /** Move all complete messages from the pipe to a framed pipe.
+        Unknown data and messages longer than the framed pipe can ever
+        hold are dropped. Stops when no complete message is available
+        or the framed pipe is full, in which case the message stays in
+        the pipe.
+        \param pipe the receiveing pipe to parse messages
+        \param frames the framed pipe the messages are added to
+        \return the number of messages moved
+    */
+    int _getMessages(Pipe<char>* pipe, FramePipe* frames);
+
+    /** Find the next message in the pipe without removing it. This is
+        a framing state machine that keeps its position between the
+        calls, so each received byte is examined once; only the bytes
+        after the start of a candidate that turned out not to be a
+        message are examined again. Whoever removes bytes from the pipe
+        has to report it with _framed().
+        \param pipe the receiveing pipe to parse messages
+        \param len numer of bytes to parse at maximum, a message that
+               does not fit is unknown data
+        \return type and length if something was found,
                 WAIT if not enough data is available
-                NOT_FOUND if nothing was found
-    */ 
-    static int _parseUbx(Pipe<char>* pipe, int len);
-    
+    */
+    int _findMessage(Pipe<char>* pipe, int len);
+
+    /** Report bytes removed from the front of the pipe parsed by
+        _findMessage(), e.g. a message or unknown data it returned.
+        \param n the number of bytes removed
+    */
+    void _framed(int n);
+
+    /** Find the first possible start of a message, a '$' or 0xB5, in a
+        contiguous region. The region is searched a word at a time, so a
+        run of unknown data (e.g. line noise) is skipped quickly.
+        \param p the start of the region
+        \param n the number of bytes in the region
+        \return the offset of the start byte, n if there is none
+    */
+    static int _findSync(const char* p, int n);
+
+    /** Get the key of a message in the dispatch table.
+        \param msg the message
+        \return the key, 0 if it can not have a handler
+    */
+    static int _key(const Message& msg);
+
+    /** Get the key of a NMEA sentence type in the dispatch table.
+        \param id the three characters of the sentence type
+        \return the key, 0 if id is NULL or not three characters long
+    */
+    static int _nmeaKey(const char* id);
+
+    /** Get the slot of the dispatch table a key is hashed to.
+        \param key the key
+        \return the first slot tried for the key
+    */
+    static int _home(int key);
+
+    /** Find the slot of a key in the dispatch table, it is hashed and
+        collisions go to the following slots.
+        \param key the key
+        \return the slot of the key or the empty slot where it belongs,
+                -1 if it is not there and the table is full
+    */
+    int _slot(int key);
+
+    /** Add a handler to the dispatch table.
+        \param key the key of the messages
+        \param handler the handler
+        \return true if done, false if the table is full
+    */
+    bool _subscribe(int key, Handler handler);
+
+    /** Remove a handler from the dispatch table, the following entries
+        of its collision chain move back so that the chain is not broken.
+        \param key the key of the messages
+    */
+    bool _unsubscribe(int key);
+
+    /** Convert a decimal number of a NMEA field, e.g. "-12.345".
+        \param p the first character of the field
+        \param end the end of the field
+        \param val the number
+        \return true if the whole field is a number
+    */
+    static bool _decimal(const char* p, const char* end, double& val);
+
+    /** Convert the decimal digits of a NMEA field, e.g. of a time.
+        \param p the first digit
+        \param n the number of digits
+        \return the number, -1 if not all are digits
+    */
+    static int _digits(const char* p, int n);
+
     /** Write bytes to the physical interface. This function 
         needs to be implemented by the inherited class. 
         \param buf the buffer to write
@@ -186,9 +474,38 @@ protected:
     */
     virtual int _send(const void* buf, int len) = 0;
     
+    /** Write several buffers to the physical interface at once, e.g. the
+        parts of a framed message. By default each segment is sent with
+        _send(), interfaces that can gather override this.
+        \param seg the segments to write
+        \param cnt the number of segments
+        \return bytes written
+    */
+    virtual int _sendv(const Pipe<char>::Seg* seg, int cnt);
+
     static const char _toHex[16]; //!< num to hex conversion
     DigitalInOut *_gnssEnable; //!< IO pin that enables GNSS
     DigitalInOut *_gnssPower; //!< IO pin that enables power to GNSS
+
+    //! state of _findMessage(), kept between the calls
+    struct Framer {
+        Pipe<char>* pipe; //!< the pipe parsed
+        int ev;     //!< evicted() of the pipe, the state is dropped if it changes
+        int st;     //!< the state, what the next byte has to be
+        int o;      //!< offset of the next byte to examine
+        int s;      //!< offset of the message candidate, the bytes before are unknown
+        int next;   //!< offset of the first start byte after s, 0 if none
+        int a;      //!< NMEA checksum or UBX checksum A
+        int b;      //!< UBX checksum B
+        int n;      //!< UBX payload bytes still to come
+        int type;   //!< protocol of the message found
+    } _fr;
+
+    //! an entry of the dispatch table
+    struct Subscription {
+        int key;         //!< the message, 0 if the slot is empty
+        Handler handler; //!< its handler
+    } _subs[GNSS_SUBSCRIPTIONS]; //!< the dispatch table
 };
 
 /** GNSS class which uses a serial port
@@ -207,13 +524,40 @@ public:
     GnssSerial(PinName tx    GNSS_IF( = GNSSTXD, /* = D8 */), // resistor on shield not populated
                PinName rx    GNSS_IF( = GNSSRXD, /* = D9 */), // resistor on shield not populated
                int baudrate  GNSS_IF( = GNSSBAUD, = 9600 ),
-               int rxSize    = 256 ,
-               int txSize    = 128 );
+               int rxSize    = GNSS_SERIAL_RX_SIZE ,
+               int txSize    = GNSS_SERIAL_TX_SIZE );
               
     //! Destructor
     virtual ~GnssSerial(void);
     
+    /** Power up the receiver and check that it is talking, at the baud
+        rate of the constructor or, with autoBaud(), at the detected one.
+        \param pn not used
+        \return true if the receiver was found
+    */
     virtual bool init(PinName pn = NC);
+
+    /** Let init() detect the baud rate of the receiver, e.g. after it
+        was reconfigured or kept its configuration on a backup battery.
+        \param on true to detect the baud rate in init()
+        \param ms the time listened at each rate, see detectBaudrate()
+    */
+    void autoBaud(bool on, int ms = GNSS_BAUD_PROBE_MS);
+
+    /** Detect the baud rate of the receiver: the current rate and then
+        the ones of GNSS_BAUD_RATES are probed, each by sending a
+        UBX-CFG-PRT poll every GNSS_BAUD_POLL_MS and scoring the received
+        bytes by the valid NMEA and UBX messages among them, until one is
+        right. Without a receiver this takes ms for each of up to 9 rates
+        but no longer than GNSS_BAUD_DETECT_MS in total (2.7 s with the
+        defaults), plus the switches of the rate. A receiver that ignores
+        UBX input is only found if it outputs NMEA within ms.
+        \param ms the time listened at each rate, a rate where the
+               receiver answers is taken as soon as it is clear
+        \return true if the rate was found and is used, false if the
+                receiver was not found at any rate
+    */
+    bool detectBaudrate(int ms = GNSS_BAUD_PROBE_MS);
     
     /** Get a line from the physical interface. 
         \param buf the buffer to store it
@@ -224,6 +568,75 @@ public:
     */ 
     virtual int getMessage(char* buf, int len);
     
+    /** Get a line from the physical interface together with the time
+        its first byte was received, see timestamps().
+        \param buf the buffer to store it
+        \param len size of the buffer
+        \param us set to the receive time in microseconds, 0 if not known
+        \return same as getMessage(buf, len)
+    */
+    virtual int getMessage(char* buf, int len, unsigned int& us);
+
+    /** Get the next message in place in the rx buffer, with its receive
+        time if timestamps() are on.
+        \param msg set to the message if something was found
+        \return same as getMessage(buf, len)
+    */
+    virtual int peekMessage(Message& msg);
+
+    /** Remove a message returned by peekMessage() from the rx buffer.
+        \param msg the message
+        \return true if done, false if it was dropped meanwhile
+    */
+    virtual bool releaseMessage(const Message& msg);
+
+    /** Move all complete messages from the physical interface to a
+        framed pipe, from where other tasks can take whole messages.
+        \param frames the framed pipe the messages are added to
+        \return the number of messages moved
+    */
+    virtual int getMessages(FramePipe* frames);
+
+    /** Record the time the first byte of each NMEA and UBX message is
+        received, getMessage(buf, len, us) then returns it.
+        \param on true to record the timestamps
+    */
+    void timestamps(bool on);
+
+    /** Change the baud rate of the receiver's UART and of the local UART
+        in lockstep, e.g. to 115200 or 460800 for higher navigation rates.
+        The receiver's port configuration is polled with UBX-CFG-PRT at the
+        current rate, sent back with the new rate, and polled again at the
+        new rate. If the receiver does not answer there, both sides go
+        back to the current rate. Messages received meanwhile are dropped.
+        \param baudrate the new baud rate
+        \param ms the time the receiver has to answer each poll
+        \return true if the receiver answered at the new rate
+    */
+    bool setBaudrate(int baudrate, int ms = GNSS_BAUD_TIMEOUT_MS);
+
+    /** Get the baud rate used with the receiver.
+        \return the baud rate
+    */
+    int getBaudrate(void);
+
+    /** Wake up a reader thread when a complete message has arrived, so
+        that it can sleep in the signal instead of polling getMessage().
+        The receive interrupt signals when a NMEA line ends or a UBX
+        message is complete according to its length field.
+        \param sig the signal raised, e.g. a PipeEvent, NULL to stop
+    */
+    void messageSignal(PipeSignal* sig);
+
+#ifdef PIPE_LOSSY
+    /** Select the lossy mode of the rx buffer. When it overflows the
+        oldest data is dropped (up to the start of the next message)
+        instead of the newest, so the latest fixes are not lost.
+        \param on true to enable the lossy mode
+    */
+    void lossy(bool on);
+#endif
+
 protected:
     /** Write bytes to the physical interface.
         \param buf the buffer to write
@@ -231,6 +644,63 @@ protected:
         \return bytes written
     */
     virtual int _send(const void* buf, int len);
+
+    /** Write several buffers to the physical interface, they are added
+        to the transmit buffer at once and sent without gaps.
+        \param seg the segments to write
+        \param cnt the number of segments
+        \return bytes written
+    */
+    virtual int _sendv(const Pipe<char>::Seg* seg, int cnt);
+
+    /** terminator predicate of messageSignal(), called from the receive
+        interrupt with each byte.
+        \return true if the byte completes a NMEA or UBX message
+    */
+    bool _terminator(char ch);
+
+    /** Poll the configuration of the receiver's UART with UBX-CFG-PRT.
+        \param cfg the 20 bytes of the configuration
+        \param ms the time the receiver has to answer
+        \return true if it answered
+    */
+    bool _pollPort(char* cfg, int ms);
+
+    /** Send the configuration of the receiver's UART with UBX-CFG-PRT,
+        with a new baud rate, and switch the local UART once it was sent.
+        \param cfg the 20 bytes of the configuration
+        \param baudrate the baud rate of both sides
+        \return false if the command could not be sent, see _switch()
+    */
+    bool _setPort(char* cfg, int baudrate);
+
+    /** Switch the local UART once everything was sent and drop what was
+        received around the switch.
+        \param baudrate the new baud rate
+        \return false if the transmitter did not get everything out in
+                time, the rate is not changed then
+    */
+    bool _switch(int baudrate);
+
+    /** Probe the current baud rate, see detectBaudrate().
+        \param ms the time to listen
+        \return true if the received bytes are mostly valid messages
+    */
+    bool _probe(int ms);
+
+#ifdef PIPE_LOSSY
+    /** frame function of the lossy mode, finds the next message start.
+        \return the number of bytes before the next possible message
+    */
+    static int _frame(const char* p0, int n0, const char* p1, int n1);
+#endif
+
+    char _rxBuf[GNSS_SERIAL_RX_SIZE]; //!< the serial rx buffer
+    char _txBuf[GNSS_SERIAL_TX_SIZE]; //!< the serial tx buffer
+    int _termPos; //!< position in the UBX message seen by _terminator(), 0 if none
+    int _termLen; //!< total length of that UBX message
+    int _baudrate; //!< the baud rate used with the receiver
+    int _probeMs;  //!< time listened at each rate by init(), 0 if the rate is not detected
 };
 
 /** GNSS class which uses a i2c as physical interface.
@@ -238,6 +708,8 @@ protected:
 class GnssI2C : public I2C, public GnssParser
 {
 public: 
+    using GnssParser::getMessage;
+
     /** Constructor
         \param sda is the I2C SDA pin (between CPU and GNSS)
         \param scl is the I2C SCL pin (CPU to GNSS)
@@ -247,7 +719,7 @@ public:
     GnssI2C(PinName sda         GNSS_IF( = NC, = D16 ),
            PinName scl          GNSS_IF( = NC, = D17 ),
            unsigned char i2cAdr GNSS_IF( = (66<<1), = (66<<1) ),
-           int rxSize           = 256 );
+           int rxSize           = GNSS_I2C_RX_SIZE );
     //! Destructor
     virtual ~GnssI2C(void);
     
@@ -264,7 +736,33 @@ public:
                 NOT_FOUND if nothing was found
     */ 
     virtual int getMessage(char* buf, int len);
+
+    /** Get the next message in place in the rx buffer.
+        \param msg set to the message if something was found
+        \return same as getMessage(buf, len)
+    */
+    virtual int peekMessage(Message& msg);
+
+    /** Remove a message returned by peekMessage() from the rx buffer.
+        \param msg the message
+        \return true if done, false if it was dropped meanwhile
+    */
+    virtual bool releaseMessage(const Message& msg);
+
+    /** Move all complete messages from the physical interface to a
+        framed pipe, from where other tasks can take whole messages.
+        \param frames the framed pipe the messages are added to
+        \return the number of messages moved
+    */
+    virtual int getMessages(FramePipe* frames);
     
+#ifdef PIPE_STATS
+    /** get the statistics of the receive buffer, e.g. to size it
+        \return the statistics
+    */
+    Pipe<char>::Stats rxStats(void);
+#endif
+
     /** send a buffer
         \param buf the buffer to write
         \param len size of the buffer to write
@@ -317,7 +815,12 @@ protected:
     */
     int _get(char* buf, int len);
     
+    /** read the available bytes from the physical interface into the pipe.
+    */
+    void _fill(void);
+
     Pipe<char> _pipe;           //!< the rx pipe
+    char _buf[GNSS_I2C_RX_SIZE];//!< the rx buffer
     unsigned char _i2cAdr;      //!< the i2c address
     static const char REGLEN;   //!< the length i2c register address
     static const char REGSTREAM;//!< the stream i2c register address
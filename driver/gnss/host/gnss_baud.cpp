@@ -0,0 +1,190 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include "mbed.h"
+#include "sim_wire.h"
+#include "gnss.h"
+
+/**
+ * @file gnss_baud.cpp
+ * Host test of the baud rate handling of GnssSerial against the
+ * simulated receiver of sim_wire.h: a rate change that the receiver
+ * accepts, one it refuses and one at which the line is garbled, where
+ * both sides have to fall back to the previous rate, and the detection
+ * of the rate of a receiver that is not at the expected one, also with
+ * the rx buffer in lossy mode and on a noisy line with a stray sentence,
+ * and the time limit of the detection without a receiver or with a
+ * stalled transmitter.  Build and run on Linux with:
+ *
+ * g++ -std=c++11 -O2 -I. -I.. gnss_baud.cpp ../gnss.cpp ../serial_pipe.cpp -o gnss_baud
+ * ./gnss_baud
+ */
+
+// ----------------------------------------------------------------
+// COMPILE-TIME MACROS
+// ----------------------------------------------------------------
+
+// The time the simulated receiver has to answer
+#define TEST_TIMEOUT_MS 200
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// A line with noise only, apart from a single valid sentence after the
+// first bytes, at any rate: the detection must not count it twice
+class NoiseWire : public SimWire
+{
+public:
+    NoiseWire(void) : _sent(0)
+    {
+    }
+
+    virtual int read(char *buf, int len, int ms)
+    {
+        static const char sentence[] = "$GPTXT,01,01,02,STRAY SENTENCE*21\r\n";
+        (void) ms;
+        if (len > 16) {
+            len = 16;
+        }
+        for (int x = 0; x < len; x++, _sent++) {
+            int o = _sent - 48;
+            buf[x] = ((o >= 0) && (o < (int) sizeof(sentence) - 1)) ? sentence[o] : 'x';
+        }
+        return len;
+    }
+
+    virtual int write(const char *buf, int len)
+    {
+        (void) buf;
+        return len;
+    }
+
+private:
+    int _sent;
+};
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Check that NMEA comes through at the current rate
+static bool receiving(GnssSerial *gnss)
+{
+    char buf[128];
+    for (int x = 0; x < 100; x++) {
+        int ret = gnss->getMessage(buf, sizeof(buf));
+        if ((ret > 0) && (PROTOCOL(ret) == GnssParser::NMEA)) {
+            return true;
+        }
+        wait_ms(1);
+    }
+    return false;
+}
+
+// Change the baud rate and check the outcome on both sides
+static int check(const char *name, GnssSerial *gnss, ReceiverWire *rx,
+                 int baudrate, bool ok, int expected)
+{
+    bool ret = gnss->setBaudrate(baudrate, TEST_TIMEOUT_MS);
+    bool pass = (ret == ok) && (gnss->getBaudrate() == expected) &&
+                (rx->rate() == expected) && receiving(gnss);
+    printf("%-10s %6d -> %6d baud: %s\n", name, baudrate, gnss->getBaudrate(),
+           pass ? "ok" : "FAILED");
+    return !pass;
+}
+
+// ----------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------
+
+int main(void)
+{
+    int errors = 0;
+    ReceiverWire rx(9600);
+    GnssSerial gnss(1, 2, 9600);
+    gnss.simConnect(&rx);
+
+    printf("Baud rate test.\n");
+    errors += check("accepted", &gnss, &rx, 115200, true, 115200);
+    rx.refuse(460800);
+    errors += check("refused", &gnss, &rx, 460800, false, 115200);
+    rx.noisy(921600);
+    errors += check("garbled", &gnss, &rx, 921600, false, 115200);
+    errors += check("back", &gnss, &rx, 9600, true, 9600);
+
+    gnss.simConnect(NULL);
+
+    // a receiver that kept another rate, found by init()
+    ReceiverWire moved(38400);
+    GnssSerial other(1, 2, 9600);
+    other.simConnect(&moved);
+    other.autoBaud(true, TEST_TIMEOUT_MS);
+    bool pass = other.init() && (other.getBaudrate() == 38400) && receiving(&other);
+    printf("%-10s %6d -> %6d baud: %s\n", "detected", 9600, other.getBaudrate(),
+           pass ? "ok" : "FAILED");
+    errors += !pass;
+
+    // and a receiver that is not there at all
+    ReceiverWire none(1234);
+    other.simConnect(&none);
+    pass = !other.detectBaudrate(TEST_TIMEOUT_MS) && (other.getBaudrate() == 38400);
+    printf("%-10s %6d -> %6d baud: %s\n", "missing", 38400, other.getBaudrate(),
+           pass ? "ok" : "FAILED");
+    errors += !pass;
+
+    // a stalled transmitter fails the switch instead of hanging it
+    other.simTxStall(true);
+    pass = !other.detectBaudrate(TEST_TIMEOUT_MS) && (other.getBaudrate() == 38400);
+    other.simTxStall(false);
+    printf("%-10s %6d -> %6d baud: %s\n", "stalled", 38400, other.getBaudrate(),
+           pass ? "ok" : "FAILED");
+    errors += !pass;
+
+    // with long probes the time limit over all rates applies
+    Timer timer;
+    timer.start();
+    pass = !other.detectBaudrate(1000) && (timer.read_ms() < GNSS_BAUD_DETECT_MS + 500);
+    printf("%-10s %6d ms of %d: %s\n", "limit", timer.read_ms(), GNSS_BAUD_DETECT_MS,
+           pass ? "ok" : "FAILED");
+    errors += !pass;
+    other.simConnect(NULL);
+
+    // the same detection with the rx buffer in lossy mode
+    ReceiverWire fast(38400);
+    GnssSerial lossy(1, 2, 9600);
+    lossy.lossy(true);
+    lossy.simConnect(&fast);
+    pass = lossy.detectBaudrate(TEST_TIMEOUT_MS) && (lossy.getBaudrate() == 38400) &&
+           receiving(&lossy);
+    printf("%-10s %6d -> %6d baud: %s\n", "lossy", 9600, lossy.getBaudrate(),
+           pass ? "ok" : "FAILED");
+    errors += !pass;
+
+    // and one that sees a single stray sentence in the noise
+    NoiseWire noise;
+    lossy.simConnect(&noise);
+    pass = !lossy.detectBaudrate(TEST_TIMEOUT_MS) && (lossy.getBaudrate() == 38400);
+    printf("%-10s %6d -> %6d baud: %s\n", "noise", 38400, lossy.getBaudrate(),
+           pass ? "ok" : "FAILED");
+    errors += !pass;
+    lossy.simConnect(NULL);
+
+    return (errors != 0);
+}
+
+// End Of File
@@ -0,0 +1,665 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <chrono>
+#include <string>
+#include "mbed.h"
+#include "gnss.h"
+
+/**
+ * @file gnss_bench.cpp
+ * Host benchmark of the message framing of GnssParser: the resumable
+ * framing state machine of _findMessage() against a copy of the former
+ * implementation, which parsed from the start of the pipe on every call
+ * and tried both protocols at every offset.  A generated stream of NMEA
+ * and UBX messages, clean, with some garbage in between and with long
+ * runs of line noise, is fed to a pipe in bursts of different sizes and
+ * the messages are taken out after each burst, like a reader polling
+ * getMessage().  Both have to find the same messages.  Moving messages to
+ * a FramePipe smaller than the unknown data or a message is checked too,
+ * and so are the message signal and the lossy rx buffer of GnssSerial.
+ * Build and run on Linux with:
+ *
+ * g++ -std=c++11 -O2 -I. -I.. gnss_bench.cpp ../gnss.cpp ../serial_pipe.cpp -o gnss_bench
+ * ./gnss_bench [kilobytes]
+ */
+
+// ----------------------------------------------------------------
+// COMPILE-TIME MACROS
+// ----------------------------------------------------------------
+
+// The default number of kilobytes of generated stream
+#define BENCH_DEFAULT_KBYTES 512
+
+// The size of the pipe, it holds the longest message of the stream
+#define BENCH_PIPE_SIZE 1024
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// A parser with the framing accessible, on no interface
+class BenchParser : public GnssParser
+{
+public:
+    BenchParser(Pipe<char> *pipe = NULL) : _pipe(pipe)
+    {
+    }
+    virtual bool init(PinName pn)
+    {
+        (void) pn;
+        return true;
+    }
+    virtual int getMessage(char *buf, int len)
+    {
+        (void) buf;
+        (void) len;
+        return WAIT;
+    }
+    int find(Pipe<char> *pipe, int len)
+    {
+        return _findMessage(pipe, len);
+    }
+    void framed(int n)
+    {
+        _framed(n);
+    }
+    int get(Pipe<char> *pipe, char *buf, int len)
+    {
+        return _getMessage(pipe, buf, len);
+    }
+    int peek(Pipe<char> *pipe, Message &msg)
+    {
+        return _peekMessage(pipe, msg);
+    }
+    bool release(Pipe<char> *pipe, const Message &msg)
+    {
+        return _releaseMessage(pipe, msg);
+    }
+    static int home(int key)
+    {
+        return _home(key);
+    }
+    int frames(Pipe<char> *pipe, FramePipe *frames)
+    {
+        return _getMessages(pipe, frames);
+    }
+    virtual int peekMessage(Message &msg)
+    {
+        return _peekMessage(_pipe, msg);
+    }
+    virtual bool releaseMessage(const Message &msg)
+    {
+        return _releaseMessage(_pipe, msg);
+    }
+
+protected:
+    virtual int _send(const void *buf, int len)
+    {
+        (void) buf;
+        return len;
+    }
+
+private:
+    Pipe<char> *_pipe;
+};
+
+// Counts the messages of a subscription
+class Counter
+{
+public:
+    Counter(void) : count(0), bad(0)
+    {
+    }
+    // Check that it is a NMEA GGA sentence
+    void gga(const GnssParser::Message &msg)
+    {
+        count++;
+        bad += (PROTOCOL(msg.type) != GnssParser::NMEA) || (msg[3] != 'G') || (msg[5] != 'A');
+    }
+    // Any message
+    void any(const GnssParser::Message &msg)
+    {
+        (void) msg;
+        count++;
+    }
+    // Check that it is UBX 0x01 0x07
+    void pvt(const GnssParser::Message &msg)
+    {
+        count++;
+        bad += (PROTOCOL(msg.type) != GnssParser::UBX) || (msg[2] != 0x01) || (msg[3] != 0x07);
+    }
+    int count;
+    int bad;
+};
+
+// Counts how often it is signalled, never parks
+class CountSignal : public PipeSignal
+{
+public:
+    CountSignal(void) : count(0)
+    {
+    }
+    virtual bool wait(int ms)
+    {
+        (void) ms;
+        return false;
+    }
+    virtual void signal(void)
+    {
+        count++;
+    }
+    int count;
+};
+
+// A way to find the next message in the pipe
+typedef int (*Find)(BenchParser *parser, Pipe<char> *pipe, int len);
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+static const char gHex[] = "0123456789ABCDEF";
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// The former _parseNmea(), _parseUbx() and _findMessage() of gnss.cpp
+static int legacyNmea(Pipe<char>::Cursor *cur, int len)
+{
+    int o = 0;
+    int c = 0;
+    char ch;
+    if (++o > len)                      return GnssParser::WAIT;
+    if ('$' != cur->next())            return GnssParser::NOT_FOUND;
+    for (;;) {
+        if (++o > len)                  return GnssParser::WAIT;
+        ch = cur->next();
+        if ('*' == ch)                  break;
+        if (!isprint(ch))               return GnssParser::NOT_FOUND;
+        c ^= ch;
+    }
+    if (++o > len)                      return GnssParser::WAIT;
+    if (gHex[(c >> 4) & 0xF] != cur->next()) return GnssParser::NOT_FOUND;
+    if (++o > len)                      return GnssParser::WAIT;
+    if (gHex[(c >> 0) & 0xF] != cur->next()) return GnssParser::NOT_FOUND;
+    if (++o > len)                      return GnssParser::WAIT;
+    if ('\r' != cur->next())           return GnssParser::NOT_FOUND;
+    if (++o > len)                      return GnssParser::WAIT;
+    if ('\n' != cur->next())           return GnssParser::NOT_FOUND;
+    return o;
+}
+
+static int legacyUbx(Pipe<char>::Cursor *cur, int l)
+{
+    int o = 0;
+    if (++o > l)                return GnssParser::WAIT;
+    if ('\xB5' != cur->next()) return GnssParser::NOT_FOUND;
+    if (++o > l)                return GnssParser::WAIT;
+    if ('\x62' != cur->next()) return GnssParser::NOT_FOUND;
+    o += 4;
+    if (o > l)                  return GnssParser::WAIT;
+    int i, j, ca, cb;
+    i = (unsigned char) cur->next(); ca  = i; cb  = ca;
+    i = (unsigned char) cur->next(); ca += i; cb += ca;
+    i = (unsigned char) cur->next(); ca += i; cb += ca;
+    j = (unsigned char) cur->next(); ca += j; cb += ca;
+    j = i + (j << 8);
+    while (j--) {
+        if (++o > l)            return GnssParser::WAIT;
+        i = (unsigned char) cur->next();
+        ca += i;
+        cb += ca;
+    }
+    ca &= 0xFF; cb &= 0xFF;
+    if (++o > l)                return GnssParser::WAIT;
+    if (ca != (unsigned char) cur->next()) return GnssParser::NOT_FOUND;
+    if (++o > l)                return GnssParser::WAIT;
+    if (cb != (unsigned char) cur->next()) return GnssParser::NOT_FOUND;
+    return o;
+}
+
+static int legacyFind(BenchParser *parser, Pipe<char> *pipe, int len)
+{
+    (void) parser;
+    int unkn = 0;
+    int sz = pipe->size();
+    int fr = pipe->free();
+    if (len > sz)
+        len = sz;
+    Pipe<char>::Cursor nmeaCur(pipe);
+    while (len > 0) {
+        nmeaCur.set(unkn);
+        Pipe<char>::Cursor ubxCur(nmeaCur);
+        int nmea = legacyNmea(&nmeaCur, len);
+        if ((nmea != GnssParser::NOT_FOUND) && (unkn > 0))
+            return GnssParser::UNKNOWN | unkn;
+        if (nmea == GnssParser::WAIT && fr)
+            return GnssParser::WAIT;
+        if (nmea > 0)
+            return GnssParser::NMEA | nmea;
+        int ubx = legacyUbx(&ubxCur, len);
+        if ((ubx != GnssParser::NOT_FOUND) && (unkn > 0))
+            return GnssParser::UNKNOWN | unkn;
+        if (ubx == GnssParser::WAIT && fr)
+            return GnssParser::WAIT;
+        if (ubx > 0)
+            return GnssParser::UBX | ubx;
+        unkn++;
+        len--;
+    }
+    if (unkn > 0)
+        return GnssParser::UNKNOWN | unkn;
+    return GnssParser::WAIT;
+}
+
+// The framing state machine of GnssParser
+static int stateFind(BenchParser *parser, Pipe<char> *pipe, int len)
+{
+    return parser->find(pipe, len);
+}
+
+// Add a NMEA sentence to the stream
+static void addNmea(std::string &s, int n)
+{
+    char buf[96];
+    int l = snprintf(buf, sizeof(buf), "$GNGGA,%06d.00,4717.11399,N,00833.91590,E,1,08,1.01,499.6,M,48.0,M,,*", n);
+    int c = 0;
+    for (int x = 1; x < l - 1; x++) {
+        c ^= buf[x];
+    }
+    s.append(buf, l);
+    s += gHex[c >> 4];
+    s += gHex[c & 0xF];
+    s += "\r\n";
+}
+
+// Add a UBX message with a random payload to the stream, or with all
+// bytes fill if it is not negative; by default a UBX-NAV-PVT
+static void addUbx(std::string &s, int len, int fill = -1, int cls = 0x01, int id = 0x07)
+{
+    std::string m;
+    m += (char) cls;
+    m += (char) id;
+    m += (char) len;
+    m += (char) (len >> 8);
+    for (int x = 0; x < len; x++) {
+        m += (char) ((fill < 0) ? rand() : fill);
+    }
+    int a = 0;
+    int b = 0;
+    for (size_t x = 0; x < m.size(); x++) {
+        a = (a + (unsigned char) m[x]) & 0xFF;
+        b = (b + a) & 0xFF;
+    }
+    s += "\xB5\x62" + m + (char) a + (char) b;
+}
+
+// Generate kbytes of messages, with up to junk random bytes in between
+static std::string stream(int kbytes, int junk)
+{
+    std::string s;
+    srand(1);
+    for (int n = 0; (int) s.size() < kbytes * 1024; n++) {
+        addNmea(s, n);
+        addUbx(s, 92);
+        if (junk) {
+            // random bytes without start bytes, a cut sentence and a
+            // start byte
+            for (int x = rand() % junk; x > 0; x--) {
+                char c = (char) rand();
+                s += ((c == '$') || (c == (char) 0xB5)) ? '\0' : c;
+            }
+            s += "$GNGSA,A,3,";
+            s += (char) 0xB5;
+        }
+    }
+    return s;
+}
+
+// Feed the stream to the pipe in bursts of the given size and take the
+// messages out after each burst; returns a checksum of the messages
+// found (type, length and bytes), the seconds taken and the count
+static unsigned int run(Find find, const std::string &s, int burst, double &seconds, int &count)
+{
+    static Pipe<char, BENCH_PIPE_SIZE> pipe;
+    static char buf[BENCH_PIPE_SIZE];
+    BenchParser parser;
+    unsigned int sum = 0;
+    count = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t ix = 0; ix < s.size(); ix += burst) {
+        int n = ((int) (s.size() - ix) < burst) ? (int) (s.size() - ix) : burst;
+        pipe.put(s.data() + ix, n);
+        int ret;
+        while ((ret = find(&parser, &pipe, sizeof(buf))) > 0) {
+            int len = LENGTH(ret);
+            pipe.get(buf, len);
+            parser.framed(len);
+            sum = (sum * 31) + PROTOCOL(ret) + len;
+            for (int x = 0; x < len; x++) {
+                sum = (sum * 31) + (unsigned char) buf[x];
+            }
+            count += (PROTOCOL(ret) != GnssParser::UNKNOWN);
+        }
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // what is left is incomplete
+    pipe.get(buf, pipe.size());
+    parser.framed(BENCH_PIPE_SIZE);
+    return sum;
+}
+
+// Feed the stream to the pipe like run() and take the messages out with
+// getMessage() into a buffer or in place with peekMessage() and
+// releaseMessage(); a decoder only looks at the header, so the sum covers
+// the type, the length and the first 6 bytes of each message
+static unsigned int runView(bool view, const std::string &s, int burst, double &seconds)
+{
+    static Pipe<char, BENCH_PIPE_SIZE> pipe;
+    static char buf[BENCH_PIPE_SIZE];
+    BenchParser parser;
+    GnssParser::Message msg;
+    unsigned int sum = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t ix = 0; ix < s.size(); ix += burst) {
+        int n = ((int) (s.size() - ix) < burst) ? (int) (s.size() - ix) : burst;
+        pipe.put(s.data() + ix, n);
+        int ret;
+        if (view) {
+            while ((ret = parser.peek(&pipe, msg)) > 0) {
+                sum = (sum * 31) + ret;
+                for (int x = 0; (x < 6) && (x < msg.length()); x++) {
+                    sum = (sum * 31) + (unsigned char) msg[x];
+                }
+                parser.release(&pipe, msg);
+            }
+        } else {
+            while ((ret = parser.get(&pipe, buf, sizeof(buf))) > 0) {
+                sum = (sum * 31) + ret;
+                for (int x = 0; (x < 6) && (x < LENGTH(ret)); x++) {
+                    sum = (sum * 31) + (unsigned char) buf[x];
+                }
+            }
+        }
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    pipe.get(buf, pipe.size());
+    return sum;
+}
+
+// Compare copying the messages out with reading them in place, returns
+// false if the messages differ
+static bool compareView(const char *name, const std::string &s, int burst)
+{
+    double copy;
+    double view;
+    unsigned int a = runView(false, s, burst, copy);
+    unsigned int b = runView(true, s, burst, view);
+    printf("%-8s %4d byte burst: copy   %7.2f ns/byte, view          %7.2f ns/byte, %5.1fx%s\n",
+           name, burst, copy * 1e9 / s.size(), view * 1e9 / s.size(), copy / view,
+           (a == b) ? "" : "  MISMATCH");
+    return a == b;
+}
+
+// A message that wraps at the end of the pipe and one longer than a
+// caller's buffer are returned whole in place
+static bool checkView(void)
+{
+    static Pipe<char, 256> pipe;
+    BenchParser parser;
+    GnssParser::Message msg;
+    std::string s;
+    char buf[256];
+    addUbx(s, 150);
+    pipe.put(buf, 200);
+    pipe.get(buf, 200);
+    pipe.put(s.data(), (int) s.size());
+    bool ok = (parser.peek(&pipe, msg) == (GnssParser::UBX | (int) s.size())) &&
+              (msg.seg[1].n > 0) && (msg.copy(buf, 0, sizeof(buf)) == (int) s.size()) &&
+              (memcmp(buf, s.data(), s.size()) == 0) && (msg.copy(buf, 40, 20) == 20) &&
+              (memcmp(buf, s.data() + 40, 20) == 0) && (msg[157] == s[157]) &&
+              (parser.peek(&pipe, msg) == (GnssParser::UBX | (int) s.size())) &&
+              parser.release(&pipe, msg) && (pipe.size() == 0);
+    printf("view of a wrapping message: %s\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// Move messages to a framed pipe that is smaller than the unknown data
+// and than a message in the stream: both are dropped, a message that only
+// fits once the reader took one waits in the pipe
+static bool checkFrames(void)
+{
+    static Pipe<char, 512> pipe;
+    FramePipe frames(128);
+    BenchParser parser;
+    std::string s(200, 'x');
+    std::string a;
+    std::string b;
+    std::string t;
+    char buf[128];
+    addNmea(a, 1);
+    addNmea(b, 2);
+    s += a;
+    pipe.put(s.data(), (int) s.size());
+    bool ok = (parser.frames(&pipe, &frames) == 1) && (pipe.size() == 0) &&
+              (frames.drop() == (GnssParser::NMEA | (int) a.size()));
+    addUbx(t, 150);
+    t += a + b;
+    pipe.put(t.data(), (int) t.size());
+    ok = ok && (parser.frames(&pipe, &frames) == 1) && (pipe.size() == (int) b.size()) &&
+         (frames.get(buf, sizeof(buf)) == (GnssParser::NMEA | (int) a.size())) &&
+         (memcmp(buf, a.data(), a.size()) == 0) && (parser.frames(&pipe, &frames) == 1) &&
+         (pipe.size() == 0) && (frames.get(buf, sizeof(buf)) == (GnssParser::NMEA | (int) b.size())) &&
+         (memcmp(buf, b.data(), b.size()) == 0) && !frames.readable();
+    printf("framed pipe with junk and an oversize message: %s\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// The receive interrupt has to signal exactly at the end of each message:
+// a UBX message fed byte by byte and in one burst, a NMEA sentence and a
+// UBX sync char that is followed by a sentence instead, the buffer is
+// large enough to take the length the sentence would give as UBX
+static bool checkSignal(void)
+{
+    GnssSerial gnss(1, 2, 9600, 32768);
+    CountSignal sig;
+    std::string ubx;
+    std::string nmea;
+    char buf[256];
+    addUbx(ubx, 40);
+    addNmea(nmea, 1);
+    gnss.messageSignal(&sig);
+    bool ok = true;
+    for (size_t x = 0; x < ubx.size(); x++) {
+        gnss.simReceive(&ubx[x], 1);
+        ok = ok && (sig.count == ((x + 1 < ubx.size()) ? 0 : 1));
+    }
+    ok = ok && (gnss.getMessage(buf, sizeof(buf)) == (GnssParser::UBX | (int) ubx.size()));
+    gnss.simReceive(ubx.data(), (int) ubx.size());
+    ok = ok && (sig.count == 2) && (gnss.getMessage(buf, sizeof(buf)) > 0);
+    gnss.simReceive(nmea.data(), (int) nmea.size());
+    ok = ok && (sig.count == 3) && (gnss.getMessage(buf, sizeof(buf)) > 0);
+    std::string cut = "\xB5" + nmea;
+    gnss.simReceive(cut.data(), (int) cut.size());
+    ok = ok && (sig.count == 4) &&
+         (gnss.getMessage(buf, sizeof(buf)) == (GnssParser::UNKNOWN | 1)) &&
+         (gnss.getMessage(buf, sizeof(buf)) == (GnssParser::NMEA | (int) nmea.size()));
+    gnss.messageSignal(NULL);
+    printf("message signal: %s\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// Overflow the rx buffer of GnssSerial in lossy mode while a message is
+// only partly framed: the oldest data has to be dropped up to the start
+// of a message, a sentence or a UBX message, and parsing has to resume
+// with the whole messages that are left
+static bool checkLossy(void)
+{
+    GnssSerial gnss(1, 2, 9600, 256);
+    std::string m[6];
+    char buf[256];
+    addNmea(m[0], 0);
+    addUbx(m[1], 40, 0x55);
+    addNmea(m[2], 2);
+    addUbx(m[3], 40, 0x55);
+    addNmea(m[4], 4);
+    addNmea(m[5], 5);
+    gnss.lossy(true);
+    std::string s = m[0] + m[1].substr(0, 20);
+    gnss.simReceive(s.data(), (int) s.size());
+    bool ok = (gnss.getMessage(buf, sizeof(buf)) == (GnssParser::NMEA | (int) m[0].size())) &&
+              (gnss.getMessage(buf, sizeof(buf)) == GnssParser::WAIT);
+    // 396 bytes for 255, only m[3] to m[5] fit
+    s = m[1].substr(20) + m[2] + m[3] + m[4] + m[5];
+    gnss.simReceive(s.data(), (int) s.size());
+    for (int x = 3; x < 6; x++) {
+        int ret = gnss.getMessage(buf, sizeof(buf));
+        ok = ok && (LENGTH(ret) == (int) m[x].size()) && (memcmp(buf, m[x].data(), m[x].size()) == 0) &&
+             (PROTOCOL(ret) == ((x == 3) ? GnssParser::UBX : GnssParser::NMEA));
+    }
+    ok = ok && (gnss.getMessage(buf, sizeof(buf)) == GnssParser::WAIT);
+    printf("lossy rx buffer: %s\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// Dispatch the stream to the handlers of GGA and UBX 0x01 0x07, with
+// other subscriptions in the table; checks what arrives, also after
+// unsubscribing, and prints the time per message
+static bool checkDispatch(const std::string &s, int nmea, int ubx)
+{
+    static Pipe<char, BENCH_PIPE_SIZE> pipe;
+    static const char *others[] = { "RMC", "GSV", "GSA", "GLL", "VTG", "ZDA", "UBX" };
+    BenchParser parser(&pipe);
+    Counter gga;
+    Counter pvt;
+    bool ok = parser.subscribeNmea("GGA", callback(&gga, &Counter::gga)) &&
+              parser.subscribeUbx(0x01, 0x07, callback(&pvt, &Counter::pvt));
+    for (size_t x = 0; x < sizeof(others) / sizeof(*others); x++) {
+        ok = parser.subscribeNmea(others[x], callback(&gga, &Counter::gga)) && ok;
+    }
+    int messages = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t ix = 0; ix < s.size(); ix += 256) {
+        int n = ((int) (s.size() - ix) < 256) ? (int) (s.size() - ix) : 256;
+        pipe.put(s.data() + ix, n);
+        messages += parser.dispatch();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ok = ok && (gga.count == nmea) && (pvt.count == ubx) && (messages == nmea + ubx) &&
+         !gga.bad && !pvt.bad;
+    printf("dispatch %d message(s) to %d subscription(s): %.1f ns/message: %s\n", messages,
+           (int) (2 + sizeof(others) / sizeof(*others)), seconds * 1e9 / messages, ok ? "ok" : "FAILED");
+
+    // without the GGA handler only UBX is passed on
+    parser.unsubscribeNmea("GGA");
+    pipe.put(s.data(), 1000);
+    messages = parser.dispatch();
+    bool gone = (messages > 0) && (gga.count == nmea) && (pvt.count == ubx + messages);
+    printf("unsubscribe: %s\n", gone ? "ok" : "FAILED");
+    return ok && gone;
+}
+
+// Three UBX messages that hash to the same slot form a collision chain:
+// after removing the first, the others have to be found where they moved
+// to; NMEA sentence types that are not three characters are refused
+static bool checkChain(void)
+{
+    static Pipe<char, BENCH_PIPE_SIZE> pipe;
+    BenchParser parser(&pipe);
+    Counter c[3];
+    int id[3];
+    int n = 0;
+    for (int x = 0; (x < 256) && (n < 3); x++) {
+        if (BenchParser::home(GnssParser::UBX | (0x0A << 8) | x) == BenchParser::home(GnssParser::UBX | (0x0A << 8))) {
+            id[n++] = x;
+        }
+    }
+    bool ok = (n == 3);
+    for (int x = 0; ok && (x < 3); x++) {
+        ok = parser.subscribeUbx(0x0A, id[x], callback(&c[x], &Counter::any));
+    }
+    ok = ok && parser.unsubscribeUbx(0x0A, id[0]) && !parser.unsubscribeUbx(0x0A, id[0]);
+    std::string s;
+    for (int x = 0; ok && (x < 3); x++) {
+        addUbx(s, 8, 0, 0x0A, id[x]);
+    }
+    pipe.put(s.data(), (int) s.size());
+    ok = ok && (parser.dispatch() == 2) && (c[0].count == 0) && (c[1].count == 1) && (c[2].count == 1);
+    ok = ok && !parser.subscribeNmea(NULL, callback(&c[0], &Counter::any)) &&
+         !parser.subscribeNmea("GG", callback(&c[0], &Counter::any)) &&
+         !parser.subscribeNmea("GGAX", callback(&c[0], &Counter::any)) &&
+         !parser.unsubscribeNmea("G") && !parser.unsubscribeNmea(NULL);
+    printf("collision chain after unsubscribe: %s\n", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// Compare the two on one stream and burst size, returns false if they
+// found different messages
+static bool compare(const char *name, const std::string &s, int burst)
+{
+    double legacy;
+    double state;
+    int legacyCount;
+    int stateCount;
+    unsigned int a = run(legacyFind, s, burst, legacy, legacyCount);
+    unsigned int b = run(stateFind, s, burst, state, stateCount);
+    printf("%-8s %4d byte burst: legacy %7.2f ns/byte, state machine %7.2f ns/byte, %5.1fx, %d message(s)%s\n",
+           name, burst, legacy * 1e9 / s.size(), state * 1e9 / s.size(), legacy / state, stateCount,
+           ((a == b) && (legacyCount == stateCount)) ? "" : "  MISMATCH");
+    return (a == b) && (legacyCount == stateCount);
+}
+
+// ----------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    int kbytes = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_KBYTES;
+    int errors = 0;
+    std::string clean = stream(kbytes, 0);
+    std::string dirty = stream(kbytes, 64);
+    std::string noise = stream(kbytes, 2048);
+
+    printf("Framing benchmark: %d kbyte(s) of NMEA and UBX through a %d byte pipe.\n",
+           kbytes, BENCH_PIPE_SIZE);
+    static const int bursts[] = { 1, 16, 256 };
+    for (size_t x = 0; x < sizeof(bursts) / sizeof(*bursts); x++) {
+        errors += !compare("clean", clean, bursts[x]);
+        errors += !compare("garbage", dirty, bursts[x]);
+        errors += !compare("noise", noise, bursts[x]);
+    }
+    errors += !compareView("clean", clean, 256);
+    errors += !compareView("garbage", dirty, 256);
+    errors += !checkView();
+    errors += !checkFrames();
+    errors += !checkSignal();
+    errors += !checkLossy();
+    int count;
+    double seconds;
+    run(stateFind, clean, 256, seconds, count);
+    errors += !checkDispatch(clean, count / 2, count / 2);
+    errors += !checkChain();
+    return (errors != 0);
+}
+
+// End Of File
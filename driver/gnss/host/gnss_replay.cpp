@@ -0,0 +1,152 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "mbed.h"
+#include "sim_wire.h"
+#include "gnss.h"
+
+/**
+ * @file gnss_replay.cpp
+ * Run GnssSerial on Linux against real data: a capture file played back
+ * at real or accelerated speed, a pseudo-terminal or a TCP connection,
+ * connected to the simulated SerialBase of mbed.h in this directory.
+ * The whole receive path, from the receive interrupt to getMessage(),
+ * is the driver code, so it can be profiled at many times the real data
+ * rate.  Build and run on Linux with:
+ *
+ * g++ -std=c++11 -O2 -I. -I.. gnss_replay.cpp ../gnss.cpp ../serial_pipe.cpp -o gnss_replay
+ * ./gnss_replay file <capture> [speed [baudrate]]
+ * ./gnss_replay pty [baudrate]
+ * ./gnss_replay tcp <host> <port> [baudrate]
+ *
+ * A speed of 0 plays the file back as fast as possible.
+ */
+
+// ----------------------------------------------------------------
+// COMPILE-TIME MACROS
+// ----------------------------------------------------------------
+
+// The baud rate if none is given
+#define REPLAY_DEFAULT_BAUD 9600
+
+// How long simPoll() waits for data in milliseconds
+#define REPLAY_POLL_MS 100
+
+// The size of the receive buffer, it holds a poll of data and the
+// longest UBX message
+#define REPLAY_RX_SIZE 2048
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+static void usage(const char *name)
+{
+    printf("Usage: %s file <capture> [speed [baudrate]]\n", name);
+    printf("       %s pty [baudrate]\n", name);
+    printf("       %s tcp <host> <port> [baudrate]\n", name);
+}
+
+// Receive until the end of the wire, print what was received
+static int replay(SimWire *wire, int baudrate, bool verbose)
+{
+    static char buf[2048];
+    GnssSerial gnss(1, 2, baudrate, REPLAY_RX_SIZE);
+    long long bytes = 0;
+    long long nmea = 0;
+    long long ubx = 0;
+    long long unknown = 0;
+    long long stamped = 0;
+    double latency = 0;
+    int n;
+    int ret;
+    unsigned int us;
+
+    gnss.timestamps(true);
+    gnss.simConnect(wire);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    do {
+        n = gnss.simPoll(REPLAY_POLL_MS);
+        bytes += (n > 0) ? n : 0;
+        while ((ret = gnss.getMessage(buf, sizeof(buf), us)) > 0) {
+            int len = LENGTH(ret);
+            if (PROTOCOL(ret) == GnssParser::NMEA) {
+                nmea++;
+            } else if (PROTOCOL(ret) == GnssParser::UBX) {
+                ubx++;
+            } else {
+                unknown++;
+            }
+            if (us) {
+                // from the first byte on the wire to the reader
+                latency += (unsigned int) (PIPE_CLOCK_US() - us);
+                stamped++;
+            }
+            if (verbose && (PROTOCOL(ret) == GnssParser::NMEA)) {
+                printf("%.*s", len, buf);
+            }
+        }
+    } while (n >= 0);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    gnss.simConnect(NULL);
+
+    printf("%lld byte(s) in %.3f second(s): %.1f kbyte/s, %lld NMEA, %lld UBX, %lld unknown, "
+           "%d overflow(s), %.0f us mean latency.\n", bytes, seconds, bytes / seconds / 1024,
+           nmea, ubx, unknown, gnss.rxOverflows(), stamped ? latency / stamped : 0.0);
+    return (unknown != 0) || (gnss.rxOverflows() != 0);
+}
+
+// ----------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    if ((argc > 2) && (strcmp(argv[1], "file") == 0)) {
+        double speed = (argc > 3) ? atof(argv[3]) : 1.0;
+        FileWire wire(argv[2], speed);
+        if (!wire.isOpen()) {
+            printf("Cannot open %s.\n", argv[2]);
+            return 1;
+        }
+        return replay(&wire, (argc > 4) ? atoi(argv[4]) : REPLAY_DEFAULT_BAUD, false);
+    }
+    if ((argc > 1) && (strcmp(argv[1], "pty") == 0)) {
+        PtyWire wire;
+        if (!wire.isOpen()) {
+            printf("Cannot open a pseudo-terminal.\n");
+            return 1;
+        }
+        printf("Connect the receiver to %s.\n", wire.name());
+        return replay(&wire, (argc > 2) ? atoi(argv[2]) : REPLAY_DEFAULT_BAUD, true);
+    }
+    if ((argc > 3) && (strcmp(argv[1], "tcp") == 0)) {
+        TcpWire wire(argv[2], argv[3]);
+        if (!wire.isOpen()) {
+            printf("Cannot connect to %s:%s.\n", argv[2], argv[3]);
+            return 1;
+        }
+        return replay(&wire, (argc > 4) ? atoi(argv[4]) : REPLAY_DEFAULT_BAUD, true);
+    }
+    usage(argv[0]);
+    return 1;
+}
+
+// End Of File
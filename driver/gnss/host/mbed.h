@@ -0,0 +1,549 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MBED_H
+#define MBED_H
+
+/**
+ * @file mbed.h
+ * Simulated mbed API for building the driver code on a Linux host: the
+ * parts of mbed that the driver uses, with a SerialBase whose "wire" is
+ * driven by the host test instead of a UART, or connected to a SimWire
+ * such as the pseudo-terminal, socket and capture file of sim_wire.h.
+ * Put this directory on the include path before anything else, e.g.
+ * -I. -I..
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <functional>
+#include <chrono>
+#include <thread>
+
+// ----------------------------------------------------------------
+// COMPILE-TIME MACROS
+// ----------------------------------------------------------------
+
+// The depth of the simulated UART receive and transmit FIFOs
+#ifndef SIM_UART_FIFO_SIZE
+#define SIM_UART_FIFO_SIZE 16
+#endif
+
+#define NC (-1)
+
+// The pins of the GNSS shield, the default of the drivers without
+// TARGET_UBLOX_C030
+#define D8  8
+#define D9  9
+#define D16 16
+#define D17 17
+
+// The GNSS power and enable pins, which the driver switches on every target
+#define GNSSPWR 18
+#define GNSSEN  19
+
+// The simulated serial port supports asynchronous (DMA) transfers
+#define DEVICE_SERIAL_ASYNCH 1
+
+#define SERIAL_EVENT_TX_COMPLETE (1 << 0)
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+typedef int PinName;
+
+enum PinDirection {
+    PIN_INPUT,
+    PIN_OUTPUT
+};
+
+enum PinMode {
+    PullNone,
+    OpenDrain,
+    PushPullNoPull
+};
+
+typedef enum {
+    DMA_USAGE_NEVER,
+    DMA_USAGE_OPPORTUNISTIC,
+    DMA_USAGE_ALWAYS
+} DMAUsage;
+
+// mbed's Callback is a std::function on the host
+template <typename F>
+using Callback = std::function<F>;
+
+typedef Callback<void(int)> event_callback_t;
+
+// Bind a member function to an object, like mbed's callback()
+template <class T, class R, class A>
+std::function<R(A)> callback(T *obj, R (T::*method)(A))
+{
+    return std::bind(method, obj, std::placeholders::_1);
+}
+
+// There are no interrupts on the host, the simulation calls the
+// handlers from the test thread
+inline void core_util_critical_section_enter(void)
+{
+}
+inline void core_util_critical_section_exit(void)
+{
+}
+
+// Waiting runs the "interrupts" of the serial ports connected to a wire,
+// see SerialBase::simConnect()
+inline void wait_us(int us);
+inline void wait_ms(int ms);
+
+// A timer on the steady clock of the host
+class Timer
+{
+public:
+    Timer(void) : _run(false), _t(0)
+    {
+    }
+    void start(void)
+    {
+        if (!_run) {
+            _t0 = std::chrono::steady_clock::now();
+            _run = true;
+        }
+    }
+    void stop(void)
+    {
+        _t = read_us();
+        _run = false;
+    }
+    void reset(void)
+    {
+        _t = 0;
+        _t0 = std::chrono::steady_clock::now();
+    }
+    int read_us(void)
+    {
+        return (int) (_t + (_run ? std::chrono::duration_cast<std::chrono::microseconds>(
+                                     std::chrono::steady_clock::now() - _t0).count() : 0));
+    }
+    int read_ms(void)
+    {
+        return read_us() / 1000;
+    }
+
+private:
+    bool _run;
+    long long _t;
+    std::chrono::steady_clock::time_point _t0;
+};
+
+// The GNSS power and enable pins, there is nothing to switch on the host
+class DigitalInOut
+{
+public:
+    DigitalInOut(PinName pin, PinDirection direction, PinMode mode, int value) : _value(value)
+    {
+        (void) pin;
+        (void) direction;
+        (void) mode;
+    }
+    DigitalInOut &operator= (int value)
+    {
+        _value = value;
+        return *this;
+    }
+    operator int (void)
+    {
+        return _value;
+    }
+
+private:
+    int _value;
+};
+
+// The reset pin of the I2C interface
+class DigitalOut
+{
+public:
+    DigitalOut(PinName pin, int value = 0) : _value(value)
+    {
+        (void) pin;
+    }
+    DigitalOut &operator= (int value)
+    {
+        _value = value;
+        return *this;
+    }
+    operator int (void)
+    {
+        return _value;
+    }
+
+private:
+    int _value;
+};
+
+// An I2C bus without devices, every transfer is not acknowledged
+class I2C
+{
+public:
+    I2C(PinName sda, PinName scl)
+    {
+        (void) sda;
+        (void) scl;
+    }
+    void frequency(int hz)
+    {
+        (void) hz;
+    }
+    int write(int address, const char *data, int length, bool repeated = false)
+    {
+        (void) address;
+        (void) data;
+        (void) length;
+        (void) repeated;
+        return -1;
+    }
+    int read(int address, char *data, int length, bool repeated = false)
+    {
+        (void) address;
+        (void) data;
+        (void) length;
+        (void) repeated;
+        return -1;
+    }
+    void stop(void)
+    {
+    }
+};
+
+// A byte transport that a simulated SerialBase can be connected to with
+// simConnect(), then simPoll() moves the bytes between the two
+class SimWire
+{
+public:
+    virtual ~SimWire(void)
+    {
+    }
+
+    // Read up to len bytes, waiting up to ms milliseconds for the first
+    // one (-1 forever); returns the number read, -1 at the end
+    virtual int read(char *buf, int len, int ms) = 0;
+
+    // Write len bytes, returns the number written
+    virtual int write(const char *buf, int len) = 0;
+
+    // The baud rate of the serial port was changed
+    virtual void baud(int baudrate)
+    {
+        (void) baudrate;
+    }
+};
+
+// Simulated serial port: bytes handed to simReceive() arrive through
+// the receive interrupt a FIFO load at a time, bytes written by the
+// driver are collected in the transmit FIFO until simTransmit() puts
+// them "on the wire", which then raises the transmit interrupt.
+// With a SimWire connected, simPoll() does both, with the bytes read
+// from and written to the wire, and so does every wait_ms() or wait_us()
+// of the driver.
+// An asynchronous write() is a transmit DMA transfer, it is completed
+// by simTransmit() which then calls its callback.
+// Alternatively a circular receive DMA can be armed with simDma(), then
+// simReceive() is one burst that is written to the DMA buffer with the
+// half and full transfer events during it and the idle-line event at
+// its end.
+class SerialBase
+{
+public:
+    enum IrqType {
+        RxIrq = 0,
+        TxIrq,
+        IrqCnt
+    };
+
+    SerialBase(PinName tx, PinName rx, int baud) :
+        _rxPtr(NULL), _rxLen(0), _txCnt(0), _txTotal(0), _txSum(0),
+        _dmaBuf(NULL), _dmaSize(0), _dmaPos(0), _txDmaPtr(NULL), _txDmaLen(0),
+        _txDmaUsage(DMA_USAGE_NEVER), _txDmaRefuse(false), _txStall(false), _wire(NULL), _baud(baud)
+    {
+        (void) tx;
+        (void) rx;
+    }
+
+    virtual ~SerialBase(void)
+    {
+    }
+
+    void baud(int baudrate)
+    {
+        _baud = baudrate;
+        if (_wire) {
+            _wire->baud(baudrate);
+        }
+    }
+
+    int readable(void)
+    {
+        return _rxLen > 0;
+    }
+
+    int writeable(void)
+    {
+        return _txCnt < SIM_UART_FIFO_SIZE;
+    }
+
+    void attach(void (*func)(void), IrqType type = RxIrq)
+    {
+        if (func) {
+            _irq[type] = func;
+        } else {
+            _irq[type] = nullptr;
+        }
+    }
+
+    template <class T, class M>
+    void attach(T *obj, M method, IrqType type = RxIrq)
+    {
+        _irq[type] = std::bind(method, obj);
+    }
+
+    void set_dma_usage_tx(DMAUsage usage)
+    {
+        _txDmaUsage = usage;
+    }
+
+    // Start an asynchronous transfer, returns 0 if started
+    int write(const uint8_t *buffer, int length, const event_callback_t &callback,
+              int event = SERIAL_EVENT_TX_COMPLETE)
+    {
+        if (_txDmaPtr || _txDmaRefuse || (length <= 0)) {
+            return -1;
+        }
+        _txDmaPtr = buffer;
+        _txDmaLen = length;
+        _txDmaDone = callback;
+        _txDmaEvent = event;
+        return 0;
+    }
+
+    // Feed bytes into the receive side, the receive interrupt is called
+    // once per FIFO load, like a UART with a FIFO threshold; returns the
+    // number of bytes the driver did not take
+    int simReceive(const char *buf, int len)
+    {
+        if (_dmaBuf) {
+            while (len > 0) {
+                // copy up to the next half or full transfer event
+                int end = (_dmaPos < _dmaSize / 2) ? _dmaSize / 2 : _dmaSize;
+                int n = (len < end - _dmaPos) ? len : end - _dmaPos;
+                memcpy(_dmaBuf + _dmaPos, buf, n);
+                _dmaPos += n;
+                buf += n;
+                len -= n;
+                if (_dmaPos == end) {
+                    _dmaEvent(_dmaPos); // half or full transfer
+                    _dmaPos %= _dmaSize;
+                }
+            }
+            _dmaEvent(_dmaPos); // idle line
+            return 0;
+        }
+        while (len > 0) {
+            int n = (len < SIM_UART_FIFO_SIZE) ? len : SIM_UART_FIFO_SIZE;
+            _rxPtr = buf;
+            _rxLen = n;
+            if (_irq[RxIrq]) {
+                _irq[RxIrq]();
+            }
+            buf += n - _rxLen;
+            len -= n - _rxLen;
+            if (_rxLen > 0) {
+                break; // the driver left bytes in the FIFO
+            }
+        }
+        _rxLen = 0;
+        return len;
+    }
+
+    // Empty the transmit FIFO onto the wire and raise the transmit
+    // interrupt if attached; returns the number of bytes sent
+    int simTransmit(void)
+    {
+        if (_txStall) {
+            return 0;
+        }
+        if (_txDmaPtr) {
+            // the transfer in progress is on the wire
+            int n = _txDmaLen;
+            const uint8_t *p = _txDmaPtr;
+            _txDmaPtr = NULL;
+            for (int x = 0; x < n; x++) {
+                _base_putc(p[x]);
+            }
+            _txCnt = 0;
+            if (_wire) {
+                _wire->write((const char *) p, n);
+            }
+            if (_txDmaEvent & SERIAL_EVENT_TX_COMPLETE) {
+                _txDmaDone(SERIAL_EVENT_TX_COMPLETE);
+            }
+            return n;
+        }
+        int n = _txCnt;
+        _txCnt = 0;
+        if (_wire && (n > 0)) {
+            _wire->write(_txFifo, n);
+        }
+        if (_irq[TxIrq]) {
+            _irq[TxIrq]();
+        }
+        return n;
+    }
+
+    // Let write() fail like on a target without asynchronous transfers
+    void simTxDmaRefuse(bool on)
+    {
+        _txDmaRefuse = on;
+    }
+
+    // Stall the transmitter, nothing leaves the FIFO until it is released
+    void simTxStall(bool on)
+    {
+        _txStall = on;
+    }
+
+    // Arm the circular receive DMA, event is called with the position
+    // the DMA writes to next, a NULL buf disarms it
+    void simDma(char *buf, int size, std::function<void(int)> event)
+    {
+        _dmaBuf = buf;
+        _dmaSize = size;
+        _dmaPos = 0;
+        _dmaEvent = event;
+    }
+
+    // Connect a wire, NULL to disconnect it
+    void simConnect(SimWire *wire)
+    {
+        _wire = wire;
+        simPort() = wire ? this : NULL;
+        if (wire) {
+            wire->baud(_baud);
+        }
+    }
+
+    // The port connected to a wire last, polled while the driver waits
+    static SerialBase *&simPort(void)
+    {
+        static SerialBase *port = NULL;
+        return port;
+    }
+
+    // Send what the driver wrote to the wire and receive what arrives
+    // from it within ms milliseconds (-1 waits forever); returns the
+    // number of bytes received, -1 at the end of the wire
+    int simPoll(int ms)
+    {
+        char buf[256];
+        while (simTransmit() > 0) {
+        }
+        int n = _wire ? _wire->read(buf, sizeof(buf), ms) : -1;
+        if (n > 0) {
+            simReceive(buf, n); // what the driver does not take is lost
+        }
+        return n;
+    }
+
+    // The number of bytes written by the driver and their checksum
+    long long simTxTotal(void)
+    {
+        return _txTotal;
+    }
+    unsigned int simTxSum(void)
+    {
+        return _txSum;
+    }
+
+protected:
+    int _base_getc(void)
+    {
+        _rxLen--;
+        return (unsigned char) *_rxPtr++;
+    }
+
+    int _base_putc(int c)
+    {
+        if (_txCnt < SIM_UART_FIFO_SIZE) {
+            _txFifo[_txCnt] = (char) c;
+        }
+        _txCnt++;
+        _txTotal++;
+        _txSum = (_txSum * 31) + (unsigned char) c;
+        return c;
+    }
+
+private:
+    std::function<void(void)> _irq[IrqCnt];
+    const char *_rxPtr;
+    int _rxLen;
+    int _txCnt;
+    long long _txTotal;
+    unsigned int _txSum;
+    char *_dmaBuf;
+    int _dmaSize;
+    int _dmaPos;
+    std::function<void(int)> _dmaEvent;
+    const uint8_t *_txDmaPtr;
+    int _txDmaLen;
+    DMAUsage _txDmaUsage;
+    bool _txDmaRefuse;
+    bool _txStall;
+    event_callback_t _txDmaDone;
+    int _txDmaEvent;
+    SimWire *_wire;
+    int _baud;
+    char _txFifo[SIM_UART_FIFO_SIZE];
+};
+
+// Wait, the connected port is polled meanwhile as its interrupts would
+// run on the target
+inline void wait_us(int us)
+{
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() +
+                                                std::chrono::microseconds(us);
+    SerialBase *port = SerialBase::simPort();
+    if (port) {
+        int ms;
+        while ((ms = (int) std::chrono::duration_cast<std::chrono::milliseconds>(
+                         end - std::chrono::steady_clock::now()).count()) > 0) {
+            port->simPoll(ms);
+        }
+        port->simPoll(0);
+    }
+    std::this_thread::sleep_until(end);
+}
+
+inline void wait_ms(int ms)
+{
+    wait_us(ms * 1000);
+}
+
+#endif
+
+// End Of File
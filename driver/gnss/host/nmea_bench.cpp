@@ -0,0 +1,298 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "mbed.h"
+#include "gnss.h"
+
+/**
+ * @file nmea_bench.cpp
+ * Host benchmark of GnssParser::decodeNmea(), which walks a sentence once
+ * and fills a NmeaFix, against the field by field extraction with
+ * getNmeaItem() and getNmeaAngle(), where each field is looked up from
+ * the start of the sentence.  Both decode generated GGA, RMC, GLL, VTG,
+ * GSA and ZDA sentences and have to agree on every field.  Build and run
+ * on Linux with:
+ *
+ * g++ -std=c++11 -O2 -I. -I.. nmea_bench.cpp ../gnss.cpp ../serial_pipe.cpp -o nmea_bench
+ * ./nmea_bench [epochs]
+ */
+
+// ----------------------------------------------------------------
+// COMPILE-TIME MACROS
+// ----------------------------------------------------------------
+
+// The default number of epochs of generated sentences
+#define BENCH_DEFAULT_EPOCHS 20000
+
+// The number of sentence types of an epoch
+#define BENCH_SENTENCES 6
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// A way to decode a sentence
+typedef bool (*Decode)(char *buf, int len, GnssParser::NmeaFix &fix);
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Add the checksum and the end to a sentence
+static std::string sentence(const char *body)
+{
+    char buf[16];
+    int c = 0;
+    for (const char *p = body + 1; *p; p++) {
+        c ^= *p;
+    }
+    snprintf(buf, sizeof(buf), "*%02X\r\n", c);
+    return std::string(body) + buf;
+}
+
+// A random angle as NMEA ddmm.mmmmm and hemisphere
+static void angle(char *buf, int size, int degrees, const char *hemispheres)
+{
+    int d = rand() % degrees;
+    double m = (rand() % 6000000) / 100000.0;
+    snprintf(buf, size, (degrees > 90) ? "%03d%08.5f,%c" : "%02d%08.5f,%c", d, m,
+             hemispheres[rand() & 1]);
+}
+
+// Generate the sentences of an epoch
+static void epoch(std::vector<std::string> &out, int n)
+{
+    char body[160];
+    char lat[32];
+    char lon[32];
+    char time[16];
+    snprintf(time, sizeof(time), "%02d%02d%02d.%02d", (n / 3600) % 24, (n / 60) % 60, n % 60, n % 100);
+    angle(lat, sizeof(lat), 90, "NS");
+    angle(lon, sizeof(lon), 180, "EW");
+    double speed = (rand() % 100000) / 1000.0;
+    double course = (rand() % 36000) / 100.0;
+    snprintf(body, sizeof(body), "$GNGGA,%s,%s,%s,%d,%02d,%.2f,%.1f,M,48.0,M,,", time, lat, lon,
+             rand() % 7, rand() % 40, (rand() % 1000) / 100.0, (rand() % 900000) / 100.0 - 500);
+    out.push_back(sentence(body));
+    snprintf(body, sizeof(body), "$GNRMC,%s,%c,%s,%s,%.3f,%.2f,%02d%02d%02d,,,A,V", time,
+             (rand() & 1) ? 'A' : 'V', lat, lon, speed, course, 1 + rand() % 28, 1 + rand() % 12, rand() % 100);
+    out.push_back(sentence(body));
+    snprintf(body, sizeof(body), "$GNGLL,%s,%s,%s,A,A", lat, lon, time);
+    out.push_back(sentence(body));
+    snprintf(body, sizeof(body), "$GNVTG,%.2f,T,,M,%.3f,N,%.3f,K,A", course, speed, speed * 1.852);
+    out.push_back(sentence(body));
+    snprintf(body, sizeof(body), "$GNGSA,A,%d,05,07,13,15,18,23,24,,,,,,%.2f,%.2f,%.2f,1", 1 + rand() % 3,
+             (rand() % 1000) / 100.0, (rand() % 1000) / 100.0, (rand() % 1000) / 100.0);
+    out.push_back(sentence(body));
+    snprintf(body, sizeof(body), "$GNZDA,%s,%02d,%02d,%04d,00,00", time, 1 + rand() % 28, 1 + rand() % 12,
+             2000 + rand() % 100);
+    out.push_back(sentence(body));
+}
+
+// The field by field extraction of the application code, the time is
+// converted like decodeNmea() does
+static bool legacyTime(int ix, char *buf, int len, GnssParser::NmeaFix &fix)
+{
+    double val;
+    if (!GnssParser::getNmeaItem(ix, buf, len, val)) {
+        return false;
+    }
+    int t = (int) val;
+    fix.ms = ((t / 10000) * 3600 + (t / 100 % 100) * 60 + (t % 100)) * 1000 +
+             (int) ((val - t) * 1000 + 0.5);
+    fix.fields |= GnssParser::FIX_TIME;
+    return true;
+}
+
+static bool legacyDecode(char *buf, int len, GnssParser::NmeaFix &fix)
+{
+    int i;
+    if ((len < 7) || (buf[0] != '$')) {
+        return false;
+    }
+#define _CHECK_TALKER(s) ((buf[3] == s[0]) && (buf[4] == s[1]) && (buf[5] == s[2]))
+    if (_CHECK_TALKER("GGA")) {
+        legacyTime(1, buf, len, fix);
+        if (GnssParser::getNmeaAngle(2, buf, len, fix.lat) && GnssParser::getNmeaAngle(4, buf, len, fix.lon)) {
+            fix.fields |= GnssParser::FIX_POS;
+        }
+        if (GnssParser::getNmeaItem(6, buf, len, fix.quality, 10)) {
+            fix.fields |= GnssParser::FIX_QUALITY;
+        }
+        if (GnssParser::getNmeaItem(7, buf, len, fix.sats, 10)) {
+            fix.fields |= GnssParser::FIX_SATS;
+        }
+        if (GnssParser::getNmeaItem(8, buf, len, fix.hdop)) {
+            fix.fields |= GnssParser::FIX_HDOP;
+        }
+        if (GnssParser::getNmeaItem(9, buf, len, fix.alt)) {
+            fix.fields |= GnssParser::FIX_ALT;
+        }
+    } else if (_CHECK_TALKER("RMC")) {
+        legacyTime(1, buf, len, fix);
+        if (GnssParser::getNmeaItem(2, buf, len, fix.status)) {
+            fix.fields |= GnssParser::FIX_STATUS;
+        }
+        if (GnssParser::getNmeaAngle(3, buf, len, fix.lat) && GnssParser::getNmeaAngle(5, buf, len, fix.lon)) {
+            fix.fields |= GnssParser::FIX_POS;
+        }
+        if (GnssParser::getNmeaItem(7, buf, len, fix.speed)) {
+            fix.fields |= GnssParser::FIX_SPEED;
+        }
+        if (GnssParser::getNmeaItem(8, buf, len, fix.course)) {
+            fix.fields |= GnssParser::FIX_COURSE;
+        }
+        if (GnssParser::getNmeaItem(9, buf, len, i, 10)) {
+            fix.day = i / 10000;
+            fix.month = i / 100 % 100;
+            fix.year = 2000 + i % 100;
+            fix.fields |= GnssParser::FIX_DATE;
+        }
+    } else if (_CHECK_TALKER("GLL")) {
+        if (GnssParser::getNmeaAngle(1, buf, len, fix.lat) && GnssParser::getNmeaAngle(3, buf, len, fix.lon)) {
+            fix.fields |= GnssParser::FIX_POS;
+        }
+        legacyTime(5, buf, len, fix);
+        if (GnssParser::getNmeaItem(6, buf, len, fix.status)) {
+            fix.fields |= GnssParser::FIX_STATUS;
+        }
+    } else if (_CHECK_TALKER("VTG")) {
+        if (GnssParser::getNmeaItem(1, buf, len, fix.course)) {
+            fix.fields |= GnssParser::FIX_COURSE;
+        }
+        if (GnssParser::getNmeaItem(5, buf, len, fix.speed)) {
+            fix.fields |= GnssParser::FIX_SPEED;
+        }
+    } else if (_CHECK_TALKER("GSA")) {
+        if (GnssParser::getNmeaItem(2, buf, len, fix.navMode, 10)) {
+            fix.fields |= GnssParser::FIX_MODE;
+        }
+        bool pdop = GnssParser::getNmeaItem(15, buf, len, fix.pdop);
+        bool hdop = GnssParser::getNmeaItem(16, buf, len, fix.hdop);
+        if (hdop) {
+            fix.fields |= GnssParser::FIX_HDOP;
+        }
+        if (GnssParser::getNmeaItem(17, buf, len, fix.vdop) && pdop && hdop) {
+            fix.fields |= GnssParser::FIX_DOP;
+        }
+    } else if (_CHECK_TALKER("ZDA")) {
+        legacyTime(1, buf, len, fix);
+        if (GnssParser::getNmeaItem(2, buf, len, fix.day, 10) &&
+            GnssParser::getNmeaItem(3, buf, len, fix.month, 10) &&
+            GnssParser::getNmeaItem(4, buf, len, fix.year, 10)) {
+            fix.fields |= GnssParser::FIX_DATE;
+        }
+    } else {
+        return false;
+    }
+#undef _CHECK_TALKER
+    return true;
+}
+
+static bool typedDecode(char *buf, int len, GnssParser::NmeaFix &fix)
+{
+    return GnssParser::decodeNmea(buf, len, fix);
+}
+
+// Returns true if the fields set in both fixes are the same
+static bool same(const GnssParser::NmeaFix &a, const GnssParser::NmeaFix &b)
+{
+    const double e = 1e-9;
+    int f = a.fields;
+    return (a.fields == b.fields) &&
+           (!(f & GnssParser::FIX_TIME) || (a.ms == b.ms)) &&
+           (!(f & GnssParser::FIX_POS) || ((fabs(a.lat - b.lat) < e) && (fabs(a.lon - b.lon) < e))) &&
+           (!(f & GnssParser::FIX_QUALITY) || (a.quality == b.quality)) &&
+           (!(f & GnssParser::FIX_SATS) || (a.sats == b.sats)) &&
+           (!(f & GnssParser::FIX_HDOP) || (fabs(a.hdop - b.hdop) < e)) &&
+           (!(f & GnssParser::FIX_ALT) || (fabs(a.alt - b.alt) < e)) &&
+           (!(f & GnssParser::FIX_SPEED) || (fabs(a.speed - b.speed) < e)) &&
+           (!(f & GnssParser::FIX_COURSE) || (fabs(a.course - b.course) < e)) &&
+           (!(f & GnssParser::FIX_DATE) || ((a.day == b.day) && (a.month == b.month) && (a.year == b.year))) &&
+           (!(f & GnssParser::FIX_STATUS) || (a.status == b.status)) &&
+           (!(f & GnssParser::FIX_MODE) || (a.navMode == b.navMode)) &&
+           (!(f & GnssParser::FIX_DOP) || ((fabs(a.pdop - b.pdop) < e) && (fabs(a.vdop - b.vdop) < e)));
+}
+
+// Decode all sentences, one fix per sentence, returns the seconds taken
+static double run(Decode decode, std::vector<std::string> &in, std::vector<GnssParser::NmeaFix> &out)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t x = 0; x < in.size(); x++) {
+        out[x].fields = 0;
+        decode(&in[x][0], (int) in[x].size(), out[x]);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// ----------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    int epochs = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_EPOCHS;
+    static const char *names[BENCH_SENTENCES] = { "GGA", "RMC", "GLL", "VTG", "GSA", "ZDA" };
+    int errors = 0;
+    std::vector<std::string> in[BENCH_SENTENCES];
+
+    srand(1);
+    for (int n = 0; n < epochs; n++) {
+        std::vector<std::string> e;
+        epoch(e, n);
+        for (int x = 0; x < BENCH_SENTENCES; x++) {
+            in[x].push_back(e[x]);
+        }
+    }
+
+    printf("NMEA decoder benchmark: %d sentence(s) of each type.\n", epochs);
+    for (int x = 0; x < BENCH_SENTENCES; x++) {
+        std::vector<GnssParser::NmeaFix> a(in[x].size());
+        std::vector<GnssParser::NmeaFix> b(in[x].size());
+        double legacy = run(legacyDecode, in[x], a);
+        double typed = run(typedDecode, in[x], b);
+        int bad = 0;
+        for (size_t y = 0; y < a.size(); y++) {
+            bad += !same(a[y], b[y]) || !b[y].fields;
+        }
+        printf("%s: getNmeaItem() %7.1f ns/sentence, decodeNmea() %6.1f ns/sentence, %5.1fx%s\n",
+               names[x], legacy * 1e9 / epochs, typed * 1e9 / epochs, legacy / typed,
+               bad ? "  MISMATCH" : "");
+        if (bad) {
+            printf("  %d mismatch(es), e.g. %s", bad, in[x][0].c_str());
+        }
+        errors += bad;
+    }
+
+    // Without a PDOP the dilutions of a GSA are not valid
+    char gsa[] = "$GNGSA,A,3,05,07,13,15,18,23,24,,,,,,,1.20,2.10,1*15\r\n";
+    GnssParser::NmeaFix fix;
+    fix.fields = 0;
+    bool ok = GnssParser::decodeNmea(gsa, (int) strlen(gsa), fix) &&
+              (fix.fields == (GnssParser::FIX_MODE | GnssParser::FIX_HDOP));
+    printf("GSA without PDOP: %s\n", ok ? "ok" : "FAILED");
+    errors += !ok;
+    return (errors != 0);
+}
+
+// End Of File
@@ -0,0 +1,415 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "mbed.h"
+#include "pipe.h"
+#include "serial_pipe.h"
+
+/**
+ * @file pipe_bench.cpp
+ * Host microbenchmark of Pipe and SerialPipe: the cost of the hot
+ * paths is measured single threaded, writer and reader taking turns,
+ * so that the numbers do not depend on the scheduler.  SerialPipe runs
+ * on the simulated SerialBase of mbed.h in this directory, receiving
+ * either with an interrupt per byte or through a circular DMA buffer
+ * that publishes whole bursts.  Build and run on Linux with:
+ *
+ * g++ -std=c++11 -O2 -I. -I.. pipe_bench.cpp ../serial_pipe.cpp -o pipe_bench
+ * ./pipe_bench [megabytes]
+ */
+
+// ----------------------------------------------------------------
+// COMPILE-TIME MACROS
+// ----------------------------------------------------------------
+
+// The default number of megabytes pushed through each benchmark
+#define BENCH_DEFAULT_MBYTES 64
+
+// The size of the pipes under test
+#define BENCH_PIPE_SIZE 256
+
+// The chunk size of the bulk benchmarks, it divides the pipe size so
+// that a chunk never wraps
+#define BENCH_CHUNK 64
+
+// The chunk size of the wrap-heavy benchmarks, it does not divide the
+// pipe size so that most chunks are split at the end of the buffer
+#define BENCH_WRAP_CHUNK 61
+
+// The size of the circular DMA buffer, it does not divide the chunk
+// size so that the DMA wraps at varying positions within a burst
+#define BENCH_DMA_SIZE 200
+
+// The size of the buffer sent with putAsync(), a multiple of the
+// chunk size that does not fit into the pipe
+#define BENCH_ASYNC_SIZE 1024
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// A benchmark moves len bytes and returns a checksum of what was read
+typedef unsigned int (*Bench)(long long len);
+
+// A signal that counts how often it was raised
+class CountSignal : public PipeSignal
+{
+public:
+    CountSignal(void) : count(0) {}
+    virtual bool wait(int ms)
+    {
+        (void) ms;
+        return false;
+    }
+    virtual void signal(void)
+    {
+        count++;
+    }
+    long long count;
+};
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+static Pipe<char, BENCH_PIPE_SIZE> gPipe;
+
+static char gData[BENCH_PIPE_SIZE];
+
+// The buffer sent with putAsync(), larger than the pipe
+static char gAsync[BENCH_ASYNC_SIZE];
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// Checksum of the bytes read, so that nothing is optimised away
+static inline unsigned int sum(unsigned int s, const char *p, int n)
+{
+    for (int x = 0; x < n; x++) {
+        s = (s * 31) + (unsigned char) p[x];
+    }
+    return s;
+}
+
+// The checksum of len bytes of the test data, what every benchmark
+// has to return
+static unsigned int expected(long long len)
+{
+    unsigned int s = 0;
+    for (long long ix = 0; ix < len; ix++) {
+        s = (s * 31) + (unsigned char) gData[ix % BENCH_CHUNK];
+    }
+    return s;
+}
+
+// putc() and getc(), half a pipe at a time
+static unsigned int singleByte(long long len)
+{
+    unsigned int s = 0;
+    for (long long ix = 0; ix < len; ix += BENCH_CHUNK) {
+        for (int x = 0; x < BENCH_CHUNK; x++) {
+            gPipe.putc(gData[x]);
+        }
+        for (int x = 0; x < BENCH_CHUNK; x++) {
+            char c = gPipe.getc();
+            s = sum(s, &c, 1);
+        }
+    }
+    return s;
+}
+
+// put() and get() of chunks that never wrap
+static unsigned int bulk(long long len)
+{
+    char buf[BENCH_CHUNK];
+    unsigned int s = 0;
+    for (long long ix = 0; ix < len; ix += BENCH_CHUNK) {
+        gPipe.put(gData, BENCH_CHUNK);
+        gPipe.get(buf, BENCH_CHUNK);
+        s = sum(s, buf, BENCH_CHUNK);
+    }
+    return s;
+}
+
+// put() and get() of chunks that mostly wrap, the data is written as
+// a BENCH_CHUNK pattern so the checksum is the same as for the others
+static unsigned int wrapHeavy(long long len)
+{
+    char buf[BENCH_WRAP_CHUNK];
+    unsigned int s = 0;
+    long long ix = 0;
+    int o = 0;
+    while (ix < len) {
+        int n = (len - ix < BENCH_WRAP_CHUNK) ? (int) (len - ix) : BENCH_WRAP_CHUNK;
+        for (int x = 0; x < n; x++) {
+            buf[x] = gData[(o + x) % BENCH_CHUNK];
+        }
+        o = (o + n) % BENCH_CHUNK;
+        gPipe.put(buf, n);
+        gPipe.get(buf, n);
+        s = sum(s, buf, n);
+        ix += n;
+    }
+    return s;
+}
+
+// reserve()/commit() and peek()/consume(), the data is not copied
+// through a buffer on the reading side
+static unsigned int inPlace(long long len)
+{
+    unsigned int s = 0;
+    for (long long ix = 0; ix < len; ix += BENCH_CHUNK) {
+        char *p0;
+        char *p1;
+        int n0;
+        int n1;
+        gPipe.reserve(BENCH_CHUNK, p0, n0, p1, n1);
+        memcpy(p0, gData, n0);
+        memcpy(p1, gData + n0, n1);
+        gPipe.commit(n0 + n1);
+        const char *q0;
+        const char *q1;
+        gPipe.peek(q0, n0, q1, n1);
+        s = sum(sum(s, q0, n0), q1, n1);
+        gPipe.consume(n0 + n1);
+    }
+    return s;
+}
+
+// set()/next()/done() as used by the message parsers
+static unsigned int parse(long long len)
+{
+    unsigned int s = 0;
+    for (long long ix = 0; ix < len; ix += BENCH_CHUNK) {
+        gPipe.put(gData, BENCH_CHUNK);
+        gPipe.set(0);
+        for (int x = 0; x < BENCH_CHUNK; x++) {
+            char c = gPipe.next();
+            s = sum(s, &c, 1);
+        }
+        gPipe.done();
+    }
+    return s;
+}
+
+// SerialPipe transmit path: put() into the pipe and the transmit
+// interrupt moving the bytes into the UART FIFO
+static unsigned int serialTx(long long len)
+{
+    SerialPipe serial(0, 1, 9600, BENCH_PIPE_SIZE, BENCH_PIPE_SIZE);
+    for (long long ix = 0; ix < len; ix += BENCH_CHUNK) {
+        int n = serial.put(gData, BENCH_CHUNK, false);
+        while (serial.simTransmit() > 0) {
+        }
+        if (n != BENCH_CHUNK) {
+            return 0;
+        }
+    }
+    return (serial.simTxTotal() == len) ? serial.simTxSum() : 0;
+}
+
+// SerialPipe transmit path with DMA: put() into the pipe and a DMA
+// transfer per contiguous region, chained from the completion interrupt;
+// the chunks are BENCH_WRAP_CHUNK bytes so that the regions wrap. If the
+// transfers are refused the transmit interrupt has to take over
+static unsigned int serialTxDmaOrIrq(long long len, bool refuse)
+{
+    SerialPipe serial(0, 1, 9600, BENCH_PIPE_SIZE, BENCH_PIPE_SIZE);
+    char buf[BENCH_WRAP_CHUNK];
+    long long ix = 0;
+    int o = 0;
+    serial.simTxDmaRefuse(refuse);
+    serial.txDma(true);
+    while (ix < len) {
+        int n = (len - ix < BENCH_WRAP_CHUNK) ? (int) (len - ix) : BENCH_WRAP_CHUNK;
+        for (int x = 0; x < n; x++) {
+            buf[x] = gData[(o + x) % BENCH_CHUNK];
+        }
+        o = (o + n) % BENCH_CHUNK;
+        if (serial.put(buf, n, false) != n) {
+            return 0;
+        }
+        while (serial.simTransmit() > 0) {
+        }
+        ix += n;
+    }
+    return (serial.simTxTotal() == len) ? serial.simTxSum() : 0;
+}
+
+static unsigned int serialTxDma(long long len)
+{
+    return serialTxDmaOrIrq(len, false);
+}
+
+static unsigned int serialTxDmaRefused(long long len)
+{
+    return serialTxDmaOrIrq(len, true);
+}
+
+// SerialPipe putAsync(): the buffer is fed to the pipe by the transmit
+// interrupt (or the DMA completion) and the completion is reported once
+static unsigned int serialTxAsync(long long len, bool dma)
+{
+    SerialPipe serial(0, 1, 9600, BENCH_PIPE_SIZE, BENCH_PIPE_SIZE);
+    long long done = 0;
+    serial.txDma(dma);
+    for (long long ix = 0; ix < len; ix += BENCH_ASYNC_SIZE) {
+        if (!serial.putAsync(gAsync, BENCH_ASYNC_SIZE, [&done](int n) { done += n; })) {
+            return 0;
+        }
+        while (serial.putAsyncBusy() && (serial.simTransmit() > 0)) {
+        }
+    }
+    return ((done == len) && (serial.simTxTotal() == len)) ? serial.simTxSum() : 0;
+}
+
+static unsigned int serialTxAsyncIrq(long long len)
+{
+    return serialTxAsync(len, false);
+}
+
+static unsigned int serialTxAsyncDma(long long len)
+{
+    return serialTxAsync(len, true);
+}
+
+// SerialPipe receive path: the receive interrupt moving the bytes from
+// the UART FIFO into the pipe and get()
+static unsigned int serialRx(long long len)
+{
+    SerialPipe serial(0, 1, 9600, BENCH_PIPE_SIZE, BENCH_PIPE_SIZE);
+    char buf[BENCH_CHUNK];
+    unsigned int s = 0;
+    for (long long ix = 0; ix < len; ix += BENCH_CHUNK) {
+        serial.simReceive(gData, BENCH_CHUNK);
+        int n = serial.get(buf, BENCH_CHUNK, false);
+        s = sum(s, buf, n);
+    }
+    // a full pipe, the byte that does not fit has to be counted
+    serial.simReceive(gData, BENCH_PIPE_SIZE);
+    return (serial.rxOverflows() == 1) ? s : 0;
+}
+
+// SerialPipe receive path with a circular DMA buffer: each chunk is one
+// burst that is published by the DMA events, not by an interrupt per byte
+static unsigned int serialRxDma(long long len)
+{
+    SerialPipe serial(0, 1, 9600, BENCH_PIPE_SIZE, BENCH_PIPE_SIZE);
+    static char dma[BENCH_DMA_SIZE];
+    char buf[BENCH_CHUNK];
+    unsigned int s = 0;
+    serial.rxDma(dma, sizeof(dma));
+    serial.simDma(dma, sizeof(dma), [&serial](int pos) { serial.rxDmaEvent(pos); });
+    for (long long ix = 0; ix < len; ix += BENCH_CHUNK) {
+        serial.simReceive(gData, BENCH_CHUNK);
+        int n = serial.get(buf, BENCH_CHUNK, false);
+        s = sum(s, buf, n);
+    }
+    return s;
+}
+
+// SerialPipe receive path signalling the reader: the test data holds
+// one '\n' per chunk, so each chunk has to raise the signal once
+static unsigned int serialRxSignal(long long len)
+{
+    SerialPipe serial(0, 1, 9600, BENCH_PIPE_SIZE, BENCH_PIPE_SIZE);
+    CountSignal sig;
+    char buf[BENCH_CHUNK];
+    unsigned int s = 0;
+    serial.rxSignal(&sig, '\n');
+    for (long long ix = 0; ix < len; ix += BENCH_CHUNK) {
+        serial.simReceive(gData, BENCH_CHUNK);
+        int n = serial.get(buf, BENCH_CHUNK, false);
+        s = sum(s, buf, n);
+    }
+    return (sig.count == len / BENCH_CHUNK) ? s : 0;
+}
+
+// SerialPipe receive path recording timestamps: the '\n' of each chunk
+// is taken as a frame start and its timestamp has to be found by position
+static unsigned int serialRxStamps(long long len)
+{
+    SerialPipe serial(0, 1, 9600, BENCH_PIPE_SIZE, BENCH_PIPE_SIZE);
+    char buf[BENCH_CHUNK];
+    unsigned int s = 0;
+    long long found = 0;
+    serial.rxStamps(4, "\n");
+    for (long long ix = 0; ix < len; ix += BENCH_CHUNK) {
+        unsigned int pos = serial.rxPos();
+        unsigned int us;
+        serial.simReceive(gData, BENCH_CHUNK);
+        int n = serial.get(buf, BENCH_CHUNK, false);
+        s = sum(s, buf, n);
+        found += serial.rxStamp(pos + 1, us);
+    }
+    return (found == len / BENCH_CHUNK) ? s : 0;
+}
+
+// Run one benchmark and print the cost per byte, returns false if the
+// checksum does not match
+static bool run(const char *name, Bench bench, long long len, unsigned int sum)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    unsigned int s = bench(len);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%-14s %7.2f ns/byte %9.1f Mbyte/s%s\n", name, seconds * 1e9 / len,
+           len / seconds / (1024 * 1024), (s == sum) ? "" : "  CHECKSUM ERROR");
+    return (s == sum) && !gPipe.readable();
+}
+
+// ----------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    int mbytes = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_MBYTES;
+    long long len = (long long) mbytes * 1024 * 1024;
+    int errors = 0;
+
+    for (int x = 0; x < (int) sizeof(gData); x++) {
+        gData[x] = (char) (x * 7 + 3);
+    }
+    for (int x = 0; x < (int) sizeof(gAsync); x++) {
+        gAsync[x] = gData[x % BENCH_CHUNK];
+    }
+    unsigned int s = expected(len);
+
+    printf("Pipe benchmark: %d Mbyte(s) through a %d byte pipe.\n", mbytes, BENCH_PIPE_SIZE);
+    errors += !run("single byte", singleByte, len, s);
+    errors += !run("bulk", bulk, len, s);
+    errors += !run("wrap heavy", wrapHeavy, len, s);
+    errors += !run("in place", inPlace, len, s);
+    errors += !run("parse", parse, len, s);
+    errors += !run("serial tx", serialTx, len, s);
+    errors += !run("serial tx dma", serialTxDma, len, s);
+    errors += !run("dma refused", serialTxDmaRefused, len, s);
+    errors += !run("async tx", serialTxAsyncIrq, len, s);
+    errors += !run("async tx dma", serialTxAsyncDma, len, s);
+    errors += !run("serial rx", serialRx, len, s);
+    errors += !run("serial rx dma", serialRxDma, len, s);
+    errors += !run("rx signal", serialRxSignal, len, s);
+    errors += !run("rx stamps", serialRxStamps, len, s);
+
+    return (errors != 0);
+}
+
+// End Of File
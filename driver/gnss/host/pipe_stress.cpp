@@ -0,0 +1,456 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <chrono>
+#include "pipe.h"
+#include "pipe_signal.h"
+#include "frame_pipe.h"
+
+/**
+ * @file pipe_stress.cpp
+ * Host stress test for Pipe: one thread writes a known byte sequence
+ * while a second thread reads and checks it, then the throughput is
+ * reported.  FramePipe, which stores whole messages in a Pipe, is checked
+ * too.  Build and run on Linux with:
+ *
+ * g++ -std=c++11 -O2 -pthread -I.. pipe_stress.cpp -o pipe_stress
+ * ./pipe_stress [megabytes]
+ */
+
+// ----------------------------------------------------------------
+// COMPILE-TIME MACROS
+// ----------------------------------------------------------------
+
+// The default number of megabytes to push through the pipe
+#define STRESS_DEFAULT_MBYTES 256
+
+// The timeout of the blocking calls when parked on signals
+#define STRESS_TIMEOUT_MS 100
+
+// The size of the pipe under test, the chunk sizes used cycle through
+// all values up to 64 so that the wrap is hit at every position
+#define STRESS_PIPE_SIZE 256
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+static Pipe<char, STRESS_PIPE_SIZE> gPipe;
+static Pipe<int, STRESS_PIPE_SIZE> gLossy;
+
+static PipeEvent gReadable;
+static PipeEvent gWriteable;
+
+static long long gTotal;
+static long long gErrors;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+// The byte expected at a given position of the stream
+static inline char pattern(long long ix)
+{
+    return (char) ((ix * 7) ^ (ix >> 8));
+}
+
+// Writer: alternate between single elements and chunks of varying size,
+// the non-blocking calls are used and the thread yields when the pipe
+// is full so that the test also makes progress on a single core host;
+// every fourth chunk is written in place using reserve() and commit()
+static void producer(void)
+{
+    char chunk[64];
+    long long ix = 0;
+    int n = 1;
+
+    while (ix < gTotal) {
+        if (n % 4 == 0) {
+            char *p0;
+            char *p1;
+            int n0;
+            int n1;
+            if (n > gTotal - ix) {
+                n = (int) (gTotal - ix);
+            }
+            int put = gPipe.reserve(n, p0, n0, p1, n1);
+            for (int x = 0; x < put; x++) {
+                *((x < n0) ? &p0[x] : &p1[x - n0]) = pattern(ix + x);
+            }
+            gPipe.commit(put);
+            if (put < n) {
+                std::this_thread::yield();
+                n = put;
+            }
+            ix += put;
+        } else if (n == 1) {
+            if (!gPipe.writeable()) {
+                std::this_thread::yield();
+                continue;
+            }
+            gPipe.putc(pattern(ix++));
+        } else {
+            if (n > gTotal - ix) {
+                n = (int) (gTotal - ix);
+            }
+            for (int x = 0; x < n; x++) {
+                chunk[x] = pattern(ix + x);
+            }
+            int put = gPipe.put(chunk, n, false);
+            if (put < n) {
+                std::this_thread::yield();
+                n = put;
+            }
+            ix += put;
+        }
+        n = (n % (int) sizeof(chunk)) + 1;
+    }
+}
+
+// Reader: the mirror image of the writer with a different step, every
+// third chunk is checked in place using peek() and consume()
+static void consumer(void)
+{
+    char chunk[64];
+    long long ix = 0;
+    int n = 1;
+
+    while (ix < gTotal) {
+        if (n % 3 == 0) {
+            const char *p0;
+            const char *p1;
+            int n0;
+            int n1;
+            int got = gPipe.peek(p0, n0, p1, n1);
+            if (got > n) {
+                got = n;
+            }
+            for (int x = 0; x < got; x++) {
+                char c = (x < n0) ? p0[x] : p1[x - n0];
+                if (c != pattern(ix + x)) {
+                    gErrors++;
+                }
+            }
+            gPipe.consume(got);
+            if (got < n) {
+                std::this_thread::yield();
+            }
+            ix += got;
+        } else if (n == 1) {
+            if (!gPipe.readable()) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (gPipe.getc() != pattern(ix)) {
+                gErrors++;
+            }
+            ix++;
+        } else {
+            if (n > gTotal - ix) {
+                n = (int) (gTotal - ix);
+            }
+            int got = gPipe.get(chunk, n, false);
+            for (int x = 0; x < got; x++) {
+                if (chunk[x] != pattern(ix + x)) {
+                    gErrors++;
+                }
+            }
+            if (got < n) {
+                std::this_thread::yield();
+            }
+            ix += got;
+        }
+        n = ((n + 4) % (int) sizeof(chunk)) + 1;
+    }
+}
+
+// Writer using the blocking calls, parked on a signal when the pipe is full
+static void blockingProducer(void)
+{
+    char chunk[64];
+    long long ix = 0;
+    int n = 1;
+
+    while (ix < gTotal) {
+        if (n == 1) {
+            gPipe.putc(pattern(ix++));
+        } else {
+            if (n > gTotal - ix) {
+                n = (int) (gTotal - ix);
+            }
+            for (int x = 0; x < n; x++) {
+                chunk[x] = pattern(ix + x);
+            }
+            ix += gPipe.put(chunk, n, true);
+        }
+        n = (n % (int) sizeof(chunk)) + 1;
+    }
+}
+
+// Reader using the blocking calls, parked on a signal when the pipe is empty
+static void blockingConsumer(void)
+{
+    char chunk[64];
+    long long ix = 0;
+    int n = 1;
+
+    while (ix < gTotal) {
+        if (n == 1) {
+            if (gPipe.getc() != pattern(ix)) {
+                gErrors++;
+            }
+            ix++;
+        } else {
+            if (n > gTotal - ix) {
+                n = (int) (gTotal - ix);
+            }
+            int got = gPipe.get(chunk, n, true);
+            for (int x = 0; x < got; x++) {
+                if (chunk[x] != pattern(ix + x)) {
+                    gErrors++;
+                }
+            }
+            ix += got;
+        }
+        n = ((n + 4) % (int) sizeof(chunk)) + 1;
+    }
+}
+
+// Lossy writer: a counter is written and never waits for the reader
+static void lossyProducer(void)
+{
+    int chunk[64];
+    long long ix = 0;
+    int n = 1;
+
+    while (ix < gTotal) {
+        if (n > gTotal - ix) {
+            n = (int) (gTotal - ix);
+        }
+        if (n == 1) {
+            gLossy.putc((int) ix);
+        } else {
+            for (int x = 0; x < n; x++) {
+                chunk[x] = (int) (ix + x);
+            }
+            if (gLossy.put(chunk, n, false) != n) {
+                gErrors++;
+            }
+        }
+        ix += n;
+        n = (n % 64) + 1;
+        if ((ix & 0xFFF) < 64) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+// Lossy reader: the counter has to increase, what was skipped has to be
+// accounted for as evicted, every third read uses peek() and consume()
+static void lossyConsumer(void)
+{
+    int chunk[64];
+    long long got = 0;
+    int last = -1;
+    int n = 1;
+
+    while ((last < gTotal - 1) && (got + gLossy.evicted() < gTotal)) {
+        int c;
+        if (n % 3 == 0) {
+            const int *p0;
+            const int *p1;
+            int n0;
+            int n1;
+            c = gLossy.peek(p0, n0, p1, n1);
+            if (c > n) {
+                c = n;
+            }
+            for (int x = 0; x < c; x++) {
+                chunk[x] = (x < n0) ? p0[x] : p1[x - n0];
+            }
+            if (!gLossy.consume(c)) {
+                c = 0;
+            }
+        } else {
+            c = gLossy.get(chunk, n, false);
+        }
+        for (int x = 0; x < c; x++) {
+            if (chunk[x] <= last) {
+                gErrors++;
+            }
+            last = chunk[x];
+        }
+        if (c == 0) {
+            std::this_thread::yield();
+        }
+        got += c;
+        n = ((n + 4) % 64) + 1;
+    }
+    if (got + gLossy.evicted() != gTotal) {
+        printf("lossy: %lld read + %d evicted != %lld written.\n", got, gLossy.evicted(), gTotal);
+        gErrors++;
+    }
+}
+
+// Run a writer and a reader thread and report the throughput
+static void run(const char* name, void (*writer)(void), void (*reader)(void))
+{
+    long long errors = gErrors;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::thread r(reader);
+    std::thread w(writer);
+    w.join();
+    r.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%s: %lld byte(s) in %.3f second(s): %.1f Mbyte/s, %lld error(s).\n",
+           name, gTotal, seconds, gTotal / seconds / (1024 * 1024), gErrors - errors);
+    if (gPipe.readable()) {
+        printf("%s: pipe not empty at the end.\n", name);
+        gErrors++;
+    }
+}
+
+// ----------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    int mbytes = (argc > 1) ? atoi(argv[1]) : STRESS_DEFAULT_MBYTES;
+    gTotal = (long long) mbytes * 1024 * 1024;
+
+    printf("Pipe stress: %d Mbyte(s) through a %d byte pipe.\n", mbytes, STRESS_PIPE_SIZE);
+
+    run("polling", producer, consumer);
+
+    gPipe.attach(&gReadable, &gWriteable, STRESS_TIMEOUT_MS);
+    run("parked", blockingProducer, blockingConsumer);
+
+    // The counter of the lossy pass wraps at 32 bits
+    if (gTotal > 0x7FFFFFFF) {
+        gTotal = 0x7FFFFFFF;
+    }
+    gLossy.lossy(true);
+    run("lossy", lossyProducer, lossyConsumer);
+    printf("lossy: %d element(s) evicted.\n", gLossy.evicted());
+
+#ifdef PIPE_STATS
+    // Everything written was read (or evicted) and the pipes were full
+    Pipe<char>::Stats s = gPipe.stats();
+    Pipe<int>::Stats l = gLossy.stats();
+    printf("stats: max %d, in %u, out %u, drops %u, blocked put %u ms, get %u ms.\n",
+           s.max, s.in, s.out, s.drops, s.putMs, s.getMs);
+    printf("lossy stats: max %d, in %u, out %u, drops %u.\n", l.max, l.in, l.out, l.drops);
+    if ((s.in != (unsigned int) (gTotal * 2)) || (s.out != s.in) || (s.drops != 0) ||
+        (s.max != STRESS_PIPE_SIZE - 1) || (l.in != l.out + l.drops) ||
+        (l.max != STRESS_PIPE_SIZE - 1)) {
+        printf("Statistics do not add up.\n");
+        gErrors++;
+    }
+#endif
+
+    // Nothing is written any more so a blocking get() has to time out
+    char c;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if ((gPipe.get(&c, 1, true) != 0) ||
+        (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(STRESS_TIMEOUT_MS))) {
+        printf("Blocking get() did not time out.\n");
+        gErrors++;
+    }
+
+    // Two cursors walk the same data, the one that is behind can not commit
+    Pipe<char>::Cursor a(&gPipe);
+    Pipe<char>::Cursor b(&gPipe);
+    gPipe.put("0123", 4);
+    if ((a.set(0) != 4) || (b.set(1) != 3) || (a.next() != '0') || (b.next() != '1') ||
+        (b.index() != 2) || !b.done() || a.done() || (gPipe.getc() != '2') ||
+        (a.set(0) != 1) || (a.next() != '3') || !a.done() || (gPipe.size() != 0)) {
+        printf("Cursors do not walk independently.\n");
+        gErrors++;
+    }
+
+    // A scatter-gather put() that only partly fits is continued later
+    Pipe<char>::Seg seg[3] = { { "$", 1 }, { "GPGGA,", 6 }, { "*hh\r\n", 5 } };
+    char buf[STRESS_PIPE_SIZE];
+    gPipe.put(buf, STRESS_PIPE_SIZE - 8);
+    int put = gPipe.put(seg, 3);
+    gPipe.get(buf, STRESS_PIPE_SIZE - 8);
+    put += gPipe.put(seg, 3, false, put);
+    if ((put != 12) || (gPipe.get(buf, sizeof(buf)) != 12) || memcmp(buf, "$GPGGA,*hh\r\n", 12)) {
+        printf("Scatter-gather put() failed.\n");
+        gErrors++;
+    }
+
+    // A cursor gives the data that wraps at the end of the buffer in place
+    // as two regions and skips over it
+    char* q0;
+    char* q1;
+    int m0, m1;
+    gPipe.reserve(STRESS_PIPE_SIZE - 1, q0, m0, q1, m1);
+    m0 = (m0 + STRESS_PIPE_SIZE - 4) % STRESS_PIPE_SIZE; // to 4 before the end
+    gPipe.put(buf, m0);
+    gPipe.get(buf, m0);
+    gPipe.put("01234567", 8);
+    const char* p0;
+    const char* p1;
+    int n0, n1;
+    Pipe<char>::Cursor w(&gPipe);
+    w.set(1);
+    if ((w.spans(6, p0, n0, p1, n1) != 6) || (n0 != 3) || (n1 != 3) ||
+        memcmp(p0, "123", 3) || memcmp(p1, "456", 3) || (w.index() != 1) ||
+        (w.skip(5), w.next() != '6') || (gPipe.get(buf, sizeof(buf)) != 8)) {
+        printf("Cursor spans() or skip() failed.\n");
+        gErrors++;
+    }
+
+    // A framed pipe returns whole messages, also when a header wraps at
+    // the end of the buffer, and refuses one that can never fit
+    FramePipe frames(64);
+    memset(buf, 'a', sizeof(buf));
+    bool ok = frames.put(0x10000, buf, 58) && (frames.peek() == (0x10000 | 58)) &&
+              (frames.get(buf, sizeof(buf)) == (0x10000 | 58)) &&
+              frames.put(0x20000, "abcdef", 6) && frames.put(0x30000, "gh", 2) &&
+              (frames.peek() == (0x20000 | 6)) && (frames.get(buf, 3) == (0x20000 | 6)) &&
+              !memcmp(buf, "abc", 3) && (frames.drop() == (0x30000 | 2)) &&
+              (frames.drop() == FramePipe::NONE) && !frames.readable() &&
+              (frames.capacity() == 59) && !frames.put(0x10000, buf, 60);
+    if (!ok) {
+        printf("Framed pipe put(), get(), peek() or drop() failed.\n");
+        gErrors++;
+    }
+
+    // In lossy mode the oldest message is evicted as a whole
+    frames.lossy(true);
+    for (int x = 0; x < 3; x++) {
+        memset(buf, 'a' + x, 20);
+        frames.put((x + 1) << 16, buf, 20);
+    }
+    ok = (frames.get(buf, sizeof(buf)) == (0x20000 | 20)) && (buf[0] == 'b') && (buf[19] == 'b') &&
+         (frames.get(buf, sizeof(buf)) == (0x30000 | 20)) && (buf[0] == 'c') &&
+         (frames.get(buf, sizeof(buf)) == FramePipe::NONE);
+    if (!ok) {
+        printf("Framed pipe lossy mode failed.\n");
+        gErrors++;
+    }
+
+    return (gErrors != 0);
+}
+
+// End Of File
@@ -0,0 +1,373 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM_WIRE_H
+#define SIM_WIRE_H
+
+/**
+ * @file sim_wire.h
+ * Byte transports for the simulated SerialBase of mbed.h: a file
+ * descriptor, a pseudo-terminal, a TCP connection and a capture file
+ * played back at real or accelerated speed.  Connect one with
+ * SerialBase::simConnect() and move the bytes with simPoll(), so that
+ * SerialPipe and GnssSerial run on Linux against real data.  There is
+ * also a simulated receiver that answers the UBX port configuration.
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <string>
+#include "mbed.h"
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+// A wire on a file descriptor, e.g. a serial device opened by the caller
+class FdWire : public SimWire
+{
+public:
+    FdWire(int fd = -1) : _fd(fd)
+    {
+    }
+
+    virtual ~FdWire(void)
+    {
+        if (_fd >= 0) {
+            close(_fd);
+        }
+    }
+
+    // Returns true if the descriptor is open
+    bool isOpen(void)
+    {
+        return _fd >= 0;
+    }
+
+    virtual int read(char *buf, int len, int ms)
+    {
+        struct pollfd p = {_fd, POLLIN, 0};
+        if (_fd < 0) {
+            return -1;
+        }
+        int n = poll(&p, 1, ms);
+        if (n <= 0) {
+            return 0; // timeout
+        }
+        n = (int) ::read(_fd, buf, len);
+        return (n > 0) ? n : -1; // hang up or error
+    }
+
+    virtual int write(const char *buf, int len)
+    {
+        int n = (_fd >= 0) ? (int) ::write(_fd, buf, len) : -1;
+        return (n > 0) ? n : 0;
+    }
+
+protected:
+    int _fd;
+};
+
+// A pseudo-terminal, the GNSS side is the terminal named by name(), e.g.
+// for a simulator or socat connected to a receiver
+class PtyWire : public FdWire
+{
+public:
+    PtyWire(void) : _slave(-1)
+    {
+        _fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if ((_fd >= 0) && ((grantpt(_fd) != 0) || (unlockpt(_fd) != 0))) {
+            close(_fd);
+            _fd = -1;
+        }
+        if (_fd >= 0) {
+            // raw bytes, no line discipline
+            struct termios t;
+            tcgetattr(_fd, &t);
+            cfmakeraw(&t);
+            tcsetattr(_fd, TCSANOW, &t);
+            // keep the terminal open, else reading hangs up until the
+            // other side opens it
+            _slave = open(ptsname(_fd), O_RDWR | O_NOCTTY);
+        }
+    }
+
+    virtual ~PtyWire(void)
+    {
+        if (_slave >= 0) {
+            close(_slave);
+        }
+    }
+
+    // The name of the terminal to connect to, NULL if not open
+    const char *name(void)
+    {
+        return (_fd >= 0) ? ptsname(_fd) : NULL;
+    }
+
+private:
+    int _slave;
+};
+
+// A TCP connection, e.g. to a receiver streaming through a network bridge
+class TcpWire : public FdWire
+{
+public:
+    TcpWire(const char *host, const char *port)
+    {
+        struct addrinfo hints;
+        struct addrinfo *res;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host, port, &hints, &res) == 0) {
+            for (struct addrinfo *a = res; a && (_fd < 0); a = a->ai_next) {
+                _fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if ((_fd >= 0) && (connect(_fd, a->ai_addr, a->ai_addrlen) != 0)) {
+                    close(_fd);
+                    _fd = -1;
+                }
+            }
+            freeaddrinfo(res);
+        }
+    }
+};
+
+// A capture file of received bytes, played back at speed times the rate
+// of the baud rate (10 bits per byte), as fast as possible if speed is
+// 0; the bytes written are discarded
+class FileWire : public SimWire
+{
+public:
+    FileWire(const char *path, double speed = 1.0) :
+        _speed(speed), _bytesPerSec(960), _sent(0)
+    {
+        _file = fopen(path, "rb");
+        _start = std::chrono::steady_clock::now();
+    }
+
+    virtual ~FileWire(void)
+    {
+        if (_file) {
+            fclose(_file);
+        }
+    }
+
+    // Returns true if the file is open
+    bool isOpen(void)
+    {
+        return _file != NULL;
+    }
+
+    virtual int read(char *buf, int len, int ms)
+    {
+        if (!_file) {
+            return -1;
+        }
+        if (_speed > 0) {
+            // the bytes due since the start, waiting up to ms for one
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() +
+                                                        std::chrono::milliseconds((ms < 0) ? 1000 : ms);
+            long long due;
+            while ((due = _due() - _sent) <= 0) {
+                if ((ms >= 0) && (std::chrono::steady_clock::now() >= end)) {
+                    return 0;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            if (len > due) {
+                len = (int) due;
+            }
+        }
+        int n = (int) fread(buf, 1, len, _file);
+        _sent += n;
+        return (n > 0) ? n : -1;
+    }
+
+    virtual int write(const char *buf, int len)
+    {
+        (void) buf;
+        return len;
+    }
+
+    virtual void baud(int baudrate)
+    {
+        // restart the pacing at the new rate
+        _sent = 0;
+        _start = std::chrono::steady_clock::now();
+        _bytesPerSec = baudrate / 10;
+    }
+
+private:
+    // The number of bytes due since the start of the pacing
+    long long _due(void)
+    {
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+        return (long long) (s * _bytesPerSec * _speed);
+    }
+
+    FILE *_file;
+    double _speed;
+    int _bytesPerSec;
+    long long _sent;
+    std::chrono::steady_clock::time_point _start;
+};
+
+// A simulated u-blox receiver on UART1: it sends a NMEA sentence each
+// time it is read and answers UBX-CFG-PRT polls and settings, which it
+// acknowledges at the old rate before switching.  When its baud rate and
+// the one of the serial port differ, both directions are garbled.
+class ReceiverWire : public SimWire
+{
+public:
+    ReceiverWire(int baudrate) :
+        _rate(baudrate), _local(0), _next(0), _refuse(0), _noisy(0), _sentences(0)
+    {
+    }
+
+    // The baud rate of the receiver
+    int rate(void)
+    {
+        return _rate;
+    }
+
+    // Answer a setting of this baud rate with a NAK
+    void refuse(int baudrate)
+    {
+        _refuse = baudrate;
+    }
+
+    // Switch to this baud rate but garble everything sent at it, like a
+    // line that is too long for it
+    void noisy(int baudrate)
+    {
+        _noisy = baudrate;
+    }
+
+    virtual int read(char *buf, int len, int ms)
+    {
+        (void) ms;
+        if (_out.size() < (size_t) len) {
+            char s[80];
+            int n = snprintf(s, sizeof(s), "$GPTXT,01,01,02,SENTENCE %d*", _sentences++);
+            int c = 0;
+            for (int x = 1; x < n - 1; x++) {
+                c ^= s[x];
+            }
+            snprintf(s + n, sizeof(s) - n, "%02X\r\n", c);
+            _out += s;
+        }
+        int n = ((int) _out.size() < len) ? (int) _out.size() : len;
+        bool garbled = (_local != _rate) || (_rate == _noisy);
+        for (int x = 0; x < n; x++) {
+            buf[x] = garbled ? (char) (_out[x] ^ 0xA5) : _out[x];
+        }
+        _out.erase(0, n);
+        if (_next) {
+            // the acknowledge went out at the old rate
+            _rate = _next;
+            _next = 0;
+        }
+        return n;
+    }
+
+    virtual int write(const char *buf, int len)
+    {
+        if (_local != _rate) {
+            return len; // not understood
+        }
+        _in.append(buf, len);
+        for (;;) {
+            size_t o = _in.find("\xB5\x62");
+            if ((o == std::string::npos) || (_in.size() < o + 6)) {
+                break;
+            }
+            _in.erase(0, o);
+            int n = (unsigned char) _in[4] + ((unsigned char) _in[5] << 8);
+            if ((int) _in.size() < 8 + n) {
+                break;
+            }
+            _message(_in.substr(2, 4 + n));
+            _in.erase(0, 8 + n);
+        }
+        return len;
+    }
+
+    virtual void baud(int baudrate)
+    {
+        _local = baudrate;
+    }
+
+private:
+    // Handle a message, msg is class, id, length and payload
+    void _message(const std::string &msg)
+    {
+        if ((msg[0] != 0x06) || (msg[1] != 0x00) || (msg[4] != 1)) {
+            return; // only CFG-PRT of UART1
+        }
+        if (msg.size() == 5) {
+            // poll: the configuration, 8N1, UBX+NMEA in and out
+            char cfg[20] = {1, 0, 0, 0, (char) 0xD0, 0x08, 0, 0,
+                            (char) _rate, (char) (_rate >> 8), (char) (_rate >> 16), (char) (_rate >> 24),
+                            3, 0, 3, 0, 0, 0, 0, 0
+                           };
+            _send(0x06, 0x00, std::string(cfg, sizeof(cfg)));
+        } else if (msg.size() == 24) {
+            int rate = (unsigned char) msg[12] | ((unsigned char) msg[13] << 8) |
+                       ((unsigned char) msg[14] << 16) | ((unsigned char) msg[15] << 24);
+            bool ok = (rate != _refuse);
+            _send(0x05, ok ? 0x01 : 0x00, std::string("\x06\x00", 2));
+            if (ok) {
+                _next = rate;
+            }
+        }
+    }
+
+    // Queue a UBX message
+    void _send(int cls, int id, const std::string &payload)
+    {
+        std::string m;
+        m += (char) cls;
+        m += (char) id;
+        m += (char) payload.size();
+        m += (char) (payload.size() >> 8);
+        m += payload;
+        int a = 0;
+        int b = 0;
+        for (size_t x = 0; x < m.size(); x++) {
+            a = (a + (unsigned char) m[x]) & 0xFF;
+            b = (b + a) & 0xFF;
+        }
+        _out += "\xB5\x62" + m + (char) a + (char) b;
+    }
+
+    int _rate;
+    int _local;
+    int _next;
+    int _refuse;
+    int _noisy;
+    int _sentences;
+    std::string _in;
+    std::string _out;
+};
+
+#endif
+
+// End Of File
@@ -16,26 +16,288 @@
 #ifndef PIPE_H
 #define PIPE_H
 
+#include <stdio.h>
+#include <string.h>
+
+/* The read and write index are handed over between the two contexts.
+   With a C++11 compiler they are std::atomic and published with
+   release / observed with acquire ordering. Older compilers (e.g.
+   gnu++98 as used by the mbed profiles) fall back to volatile indices
+   that are fenced around the hand-over. Define PIPE_NO_ATOMIC to force
+   the fallback.
+*/
+#if (__cplusplus >= 201103L) && !defined(PIPE_NO_ATOMIC)
+ #include <atomic>
+ #define PIPE_ATOMIC
+#endif
+
+#if (__cplusplus >= 201103L)
+ #define PIPE_STATIC_ASSERT(c, m) static_assert(c, m) //!< compile time check
+#else
+ #define PIPE_STATIC_ASSERT(c, m) typedef char _pipeStaticAssert[(c) ? 1 : -1]
+#endif
+
+/* Runtime checks of the arguments, MBED_ASSERT() on mbed targets and
+   assert() elsewhere. Define PIPE_ASSERT to use something else.
+*/
+#ifndef PIPE_ASSERT
+ #if defined(MBED_ASSERT)
+  #define PIPE_ASSERT(c) MBED_ASSERT(c) //!< runtime check
+ #else
+  #include <assert.h>
+  #define PIPE_ASSERT(c) assert(c) //!< runtime check
+ #endif
+#endif
+
+#ifndef PIPE_CAS
+ #if defined(__GNUC__)
+  #define PIPE_CAS(p, e, d) __sync_bool_compare_and_swap(p, e, d) //!< compare and swap for the volatile fallback
+ #endif
+#endif
+
+/* The lossy mode needs a compare and swap of the read index as the writer
+   then moves it too. This is available with std::atomic or with PIPE_CAS.
+*/
+#if defined(PIPE_ATOMIC) || defined(PIPE_CAS)
+ #define PIPE_LOSSY
+#endif
+
+/* Define PIPE_STATS to count what goes through each pipe (see
+   Pipe::stats()), e.g. to size the buffers of a deployment. Without it
+   the counters are not compiled in at all. The time blocked is taken
+   from PIPE_CLOCK_US(), a free running microsecond clock, which also
+   timestamps the messages received by SerialPipe.
+*/
+#if !defined(PIPE_CLOCK_US)
+ #if defined(__MBED__)
+  #include "us_ticker_api.h"
+  #define PIPE_CLOCK_US() us_ticker_read() //!< microsecond clock for the statistics
+ #elif (__cplusplus >= 201103L)
+  #include <chrono>
+  #define PIPE_CLOCK_US() (unsigned int) std::chrono::duration_cast<std::chrono::microseconds>( \
+                              std::chrono::steady_clock::now().time_since_epoch()).count()
+ #else
+  #define PIPE_CLOCK_US() 0u //!< no clock, the time blocked is not measured
+ #endif
+#endif
+
+#ifndef PIPE_FENCE
+ #if defined(__GNUC__)
+  #define PIPE_FENCE() __sync_synchronize() //!< memory barrier for the volatile fallback
+ #else
+  #define PIPE_FENCE() /* volatile access order only */
+ #endif
+#endif
+
+/** wake-up signal used by the blocking functions of a Pipe. Without
+    a signal attached the blocking functions spin, with signals attached
+    the waiting context is parked on them and woken by the other context.
+    See pipe_signal.h for implementations.
+*/
+class PipeSignal
+{
+public:
+    //! Destructor
+    virtual ~PipeSignal(void) {}
+
+    /** park the calling context until signalled
+        \param ms timeout in milliseconds, -1 waits forever
+        \return true if signalled, false if the timeout expired
+    */
+    virtual bool wait(int ms) = 0;
+
+    /** wake up the parked context, this may be called from an interrupt
+    */
+    virtual void signal(void) = 0;
+};
+
+template <class T, int N = 0>
+class Pipe;
+
 /** pipe, this class implements a buffered pipe that can be savely 
     written and read between two context. E.g. Written from a task 
     and read from a interrupt.
+
+    The pipe is a single producer / single consumer ring, all functions
+    in the writing API must be called from one context and all functions
+    in the reading API from one other context. Each side keeps a local
+    copy of the other side's index and only re-reads the shared index
+    when the copy does not show enough data or space.
+
+    The size of the buffer is always a power of two so that the indices
+    wrap with a mask. Pipe<T> takes its size at runtime, Pipe<T, N>
+    (see below) holds a buffer of N elements inside the object.
+
+    In lossy mode (see lossy()) the writer never waits, it removes the
+    oldest elements instead so that the pipe always holds the newest data.
 */
 template <class T>
-class Pipe
+class Pipe<T, 0>
 {
 public:
+    /** optional frame function for the lossy mode. It gets the data at the
+        read position as up to two contiguous regions and returns the number
+        of elements of the oldest frame, so that whole frames are removed.
+    */
+    typedef int (*Frame)(const T* p0, int n0, const T* p1, int n1);
+
+    //! a segment of a scatter-gather put()
+    struct Seg {
+        const T* p; //!< the elements
+        int n;      //!< the number of elements
+    };
+
+    /** parse cursor, walks the unread elements of a pipe in the reading
+        context without removing them. A pipe can have any number of
+        cursors, e.g. one per protocol detector or a diagnostic tap that
+        never commits, each of them is set and committed on its own.
+        Cursors can be copied to fork a walk at the current position.
+    */
+    class Cursor
+    {
+    public:
+        /** Constructor
+            \param pipe the pipe to walk
+        */
+        Cursor(Pipe<T, 0>* pipe) : _p(pipe), _o(0), _r(0)
+        {
+        }
+
+        /** set the parsing index and return the number of available
+            elements starting this position.
+            \param ix the index relative to the read position
+            \return the number of elements starting at this position
+        */
+        int set(int ix)
+        {
+            int r = _p->_rd();
+            int sz = _p->_avail(_p->_s, r);
+            ix = (ix > sz) ? sz : ix;
+            _r = r;
+            _o = _p->_inc(r, ix);
+            return sz - ix;
+        }
+
+        /** get the next element from parsing position and increment parsing index
+            \return the extracted element.
+        */
+        T next(void)
+        {
+            int o = _o;
+            T t = _p->_b[o];
+            _o = _p->_inc(o);
+            return t;
+        }
+
+        /** get the next n elements from the parsing position in place, as
+            up to two contiguous regions like peek(), e.g. to search them
+            with memchr(). The parsing position is not moved.
+            \param n the number of elements, at most the number returned
+                     by set() for the current position
+            \param p0 set to the start of the first region
+            \param n0 set to the number of elements in the first region
+            \param p1 set to the start of the second region
+            \param n1 set to the number of elements in the second region
+            \return n
+        */
+        int spans(int n, const T*& p0, int& n0, const T*& p1, int& n1)
+        {
+            return _p->_spans(_o, n, p0, n0, p1, n1);
+        }
+
+        /** move the parsing position forward without reading the elements
+            \param n the number of elements to skip
+        */
+        void skip(int n)
+        {
+            _o = _p->_inc(_o, n);
+        }
+
+        /** get the parsing index
+            \return the index relative to the read position at set()
+        */
+        int index(void)
+        {
+            return (_o - _r) & _p->_m;
+        }
+
+        /** commit the index, mark the data up to the parsing index as consumed.
+            \return true if successful, false if the elements were already
+                    consumed past the parsing index by another cursor or were
+                    evicted (lossy mode), what was parsed is invalid
+        */
+        bool done(void)
+        {
+            int r = _p->_rd();
+            if (((r - _r) & _p->_m) > index())
+                return false;
+            return _p->_commit(r, _o);
+        }
+
+    private:
+        Pipe<T, 0>* _p; //!< the pipe
+        int         _o; //!< the parsing index
+        int         _r; //!< the read index at set()
+    };
+    friend class Cursor;
+
+#ifdef PIPE_STATS
+    /** the statistics of a pipe, all counters are totals since construction
+        and wrap around
+    */
+    struct Stats {
+        int max;            //!< high-water mark, most elements stored at once
+        unsigned int in;    //!< elements written
+        unsigned int out;   //!< elements read
+        unsigned int drops; //!< elements dropped, by the writer (overflow()) or evicted
+        unsigned int putMs; //!< time the writer was blocked in milliseconds
+        unsigned int getMs; //!< time the reader was blocked in milliseconds
+    };
+#endif
+
     /* Constructor
-        \param n size of the pipe/buffer
+        \param n size of the pipe/buffer, the pipe can hold up to n - 1 elements.
+                 A size that is not a power of two is rounded up if the
+                 buffer is allocated. The size of a given buffer has to be
+                 a power of two, else this asserts (and uses only the
+                 largest power of two that fits if asserts are disabled).
         \param b optional buffer that should be used. 
                  if NULL the constructor will allocate a buffer of size n. 
     */
-    Pipe(int n, T* b = NULL)
+    Pipe(int n, T* b = NULL) : _r(0), _w(0), _c(this)
     {
-        _a = b ? NULL : n ? new T[n] : NULL;
-        _r = 0;
-        _w = 0;
+        PIPE_ASSERT(!b || (n <= 1) || !(n & (n - 1)));
+        int s = 1;
+        while ((s < n) && (s <= (0x7FFFFFFF >> 1)))
+            s <<= 1;
+        if (b && (s > n) && (s > 1))
+            s >>= 1;
+        _a = b ? NULL : (s > 1) ? new T[s] : NULL;
         _b = b ? b : _a;
-        _s = n;
+        _s = s;
+        _m = s - 1;
+        _rc = 0;
+        _wc = 0;
+        _sr = NULL;
+        _sw = NULL;
+        _tmo = -1;
+        _fr = false;
+        _fw = false;
+        _ev = 0;
+        _nd = 0;
+        _pr = 0;
+        _lossy = false;
+        _frame = NULL;
+#ifdef PIPE_STATS
+        _hw = 0;
+        _ni = 0;
+        _no = 0;
+        for (int i = 0; i < 2; i ++) {
+            _tw[i] = 0;
+            _tus[i] = 0;
+            _tb[i] = false;
+        }
+#endif
     }    
     /** Destructor 
         frees a allocated buffer.
@@ -45,17 +307,92 @@ public:
         if (_a) 
             delete [] _a;
     }
+
+    /** park the blocking functions on signals instead of spinning
+        \param r the signal the reader waits on, raised by the writer when
+                 elements were added, NULL to let the reader spin
+        \param w the signal the writer waits on, raised by the reader when
+                 elements were removed, NULL to let the writer spin
+        \param ms timeout in milliseconds for the blocking put() and get()
+                 or -1 to wait forever, putc() and getc() always wait forever
+    */
+    void attach(PipeSignal* r, PipeSignal* w, int ms = -1)
+    {
+        _sr = r;
+        _sw = w;
+        _tmo = ms;
+    }
     
+#ifdef PIPE_LOSSY
+    /** select the lossy mode. When the pipe is full the writer removes the
+        oldest elements instead of waiting (putc() and put() then never block,
+        reserve() makes room). The reader has to check the return value of
+        consume() and done(), or evicted(), as data it inspected may be gone.
+        \param on true to enable the lossy mode
+        \param frame optional function to remove whole frames instead of
+                     single elements
+    */
+    void lossy(bool on, Frame frame = NULL)
+    {
+        _frame = frame;
+        _lossy = on;
+    }
+#endif
+
+    /** check if the pipe is in lossy mode
+        \return true if lossy
+    */
+    bool isLossy(void)
+    {
+        return _lossy;
+    }
+
+    /** Get the number of elements removed by the writer in lossy mode.
+        This can be called from both contexts.
+        \return the number of elements evicted (wraps at INT_MAX)
+    */
+    int evicted(void)
+    {
+        return _ld(_ev);
+    }
+
+#ifdef PIPE_STATS
+    /** Get the statistics, this can be called from both contexts.
+        \return a snapshot of the counters
+    */
+    Stats stats(void)
+    {
+        Stats s;
+        s.max = _ld(_hw);
+        s.in = _ld(_ni);
+        s.out = _ld(_no);
+        s.drops = _ld(_nd) + _ld(_ev);
+        s.putMs = _ld(_tw[1]);
+        s.getMs = _ld(_tw[0]);
+        return s;
+    }
+#endif
+
+    /** Get the number of elements the writer reported with overflow().
+        This can be called from both contexts.
+        \return the number of elements dropped (wraps at INT_MAX)
+    */
+    int overflowed(void)
+    {
+        return _ld(_nd);
+    }
+
     /* This function can be used during debugging to hexdump the 
        content of a buffer to the stdout. 
     */
     void dump(void)
     {
-        int o = _r;
+        int o = _rd();
+        int w = _ld(_w);
         printf("pipe: %d/%d ", size(), _s);
-        while (o != _w) {
+        while (o != w) {
             T t = _b[o]; 
-            printf("%0*X", sizeof(T)*2, t);
+            printf("%0*X", (int)sizeof(T)*2, t);
             o = _inc(o); 
         }
         printf("\n");
@@ -69,7 +406,7 @@ public:
     */
     bool writeable(void)
     {
-        return free() > 0;
+        return _free(1) > 0;
     }
     
     /** Return the number of free elements in the buffer 
@@ -77,25 +414,33 @@ public:
     */
     int free(void)
     {
-        int s = _r - _w;
-        if (s <= 0)
-            s += _s;
-        return s - 1;
+        return (_ld(_r) - _ld(_w) - 1) & _m;
     }
     
+    /** Count elements the writer could not add and dropped (e.g. received
+        by an interrupt while the pipe is full), see overflowed().
+        \param n the number of elements dropped
+    */
+    void overflow(int n = 1)
+    {
+        _st(_nd, _own(_nd) + n);
+    }
+
     /* Add a single element to the buffer. (blocking)
         \param c the element to add.
         \return c
     */
     T putc(T c)
     {
-        int i = _w;
-        int j = i;
-        i = _inc(i);
-        while (i == _r) // = !writeable() 
-            /* nothing / just wait */;
+        int j = _own(_w);
+        int i = _inc(j);
+        while (i == _rc) // = !writeable()
+            if (!_free(1)) _lossy ? _evict(1) : (void)_park(true, -1); /* just wait */
+        _waited(true);
         _b[j] = c;
-        _w = i; 
+        _st(_w, i);
+        _added(i, 1);
+        _wake(true);
         return c;
     }
     
@@ -113,24 +458,136 @@ public:
             int f;
             for (;;) // wait for space
             {
-                f = free();
+                f = _free(c);
                 if (f > 0) break;     // data avail
+                if (_lossy) {         // make room
+                    _evict((c < _m) ? c : _m);
+                    continue;
+                }
                 if (!t) return n - c; // no more space and not blocking
-                /* nothing / just wait */;
+                if (!_park(true, _tmo)) return n - c; // timeout
             }
+            _waited(true);
             // check free space
             if (c < f) f = c;
-            int w = _w;
+            int w = _own(_w);
             int m = _s - w; 
             // check wrap
             if (f > m) f = m;
-            memcpy(&_b[w], p, f);
-            _w = _inc(w, f);
+            memcpy(&_b[w], p, f * sizeof(T));
+            _st(_w, _inc(w, f));
+            _added(_inc(w, f), f);
+            _wake(true);
             c -= f;
             p += f;
         }
         return n - c;
     }
+
+    /** Add several segments of elements (scatter-gather). The elements
+        that fit are published at once, so the reader never sees only a
+        part of them if they all fit.
+        \param seg the segments
+        \param cnt the number of segments
+        \param t set to true if blocking, false otherwise
+        \param o the number of elements at the start to skip, this allows
+                 to continue a partial put()
+        \return number elements added
+    */
+    int put(const Seg* seg, int cnt, bool t = false, int o = 0)
+    {
+        int n = -o;
+        for (int i = 0; i < cnt; i ++)
+            n += seg[i].n;
+        // find the first element to add
+        while (cnt && (o >= seg->n)) {
+            o -= seg->n;
+            seg ++;
+            cnt --;
+        }
+        int c = n;
+        while (c > 0)
+        {
+            T* d[2];
+            int f[2];
+            int r = reserve(c, d[0], f[0], d[1], f[1]);
+            if (!r) {
+                if (!t) break;                // no space and not blocking
+                if (!_park(true, _tmo)) break; // timeout
+                continue;
+            }
+            _waited(true);
+            // gather the segments into the reserved regions
+            for (int i = 0; i < 2; i ++) {
+                while (f[i]) {
+                    int k = seg->n - o;
+                    if (k > f[i]) k = f[i];
+                    memcpy(d[i], seg->p + o, k * sizeof(T));
+                    d[i] += k;
+                    f[i] -= k;
+                    o += k;
+                    if (o == seg->n) {
+                        o = 0;
+                        seg ++;
+                    }
+                }
+            }
+            commit(r);
+            c -= r;
+        }
+        return n - c;
+    }
+
+    /** get free space in place so that a producer (e.g. a DMA or a bus
+        read) can write directly into the pipe. The space is returned as
+        up to two contiguous regions, the second region is only used if
+        the space wraps at the end of the buffer. The elements become
+        visible to the reader when they are published with commit().
+        \param n the maximum number of elements the caller wants to write
+        \param p0 set to the start of the first region
+        \param n0 set to the number of elements in the first region
+        \param p1 set to the start of the second region
+        \param n1 set to the number of elements in the second region
+        \return the number of elements reserved (n0 + n1)
+    */
+    int reserve(int n, T*& p0, int& n0, T*& p1, int& n1)
+    {
+        int w = _own(_w);
+        if (_lossy)
+            _evict((n < _m) ? n : _m);
+        int f = _free(n);
+        int m = _s - w;
+        if (n < f) f = n;
+        p0 = &_b[w];
+        n0 = (f > m) ? m : f;
+        p1 = _b;
+        n1 = f - n0;
+        return f;
+    }
+
+    /** publish elements that were written to the space given by reserve()
+        \param n the number of elements to publish, this must not be more
+                 than the number returned by reserve()
+    */
+    void commit(int n)
+    {
+        int w = _inc(_own(_w), n);
+        _st(_w, w);
+        _added(w, n);
+        _wake(true);
+    }
+
+    /** wait until the pipe is writeable, the caller is parked on the
+        signal given to attach() or spins if there is none.
+        \return true if writeable, false if the timeout expired
+    */
+    bool waitWriteable(void)
+    {
+        while (!writeable())
+            if (!_park(true, _tmo)) return false;
+        _waited(true);
+        return true;
+    }
     
     // reading thread/context API
     // --------------------------------------------------------
@@ -140,7 +597,7 @@ public:
     */
     bool readable(void)
     {
-        return (_r != _w);
+        return _avail(1, _rd()) > 0;
     }
     
     /** Get the number of values available in the buffer
@@ -148,23 +605,33 @@ public:
     */
     int size(void)
     {
-        int s = _w - _r;
-        if (s < 0)
-            s += _s;
-        return s;
+        return (_ld(_w) - _ld(_r)) & _m;
     }
     
+    /** Get the number of values the buffer can hold at most
+        \return the capacity, one less than the size of the buffer
+    */
+    int capacity(void)
+    {
+        return _m;
+    }
+
     /** get a single value from buffered pipe (this function will block if no values available)
         \return the element extracted
     */
     T getc(void)
     {
-        int r = _r;
-        while (r == _w) // = !readable()
-            /* nothing / just wait */;
-        T t = _b[r];
-        _r = _inc(r);
-        return t;
+        for (;;)
+        {
+            int r = _rd();
+            while (!_avail(1, r)) // = !readable()
+                _park(false, -1); /* just wait */
+            _waited(false);
+            T t = _b[r];
+            if (_commit(r, _inc(r)))
+                return t;
+            // lossy: the element was evicted while reading, try again
+        }
     }
     
     /*! get elements from the buffered pipe
@@ -178,30 +645,98 @@ public:
         int c = n;
         while (c)
         {
-            int f;
+            int f, r;
             for (;;) // wait for data
             {
-                f = size();
+                r = _rd();
+                f = _avail(c, r);
                 if (f)  break;        // free space
                 if (!t) return n - c; // no space and not blocking
-                /* nothing / just wait */;
+                if (!_park(false, _tmo)) return n - c; // timeout
             }
+            _waited(false);
             // check available data
             if (c < f) f = c;
-            int r = _r;
             int m = _s - r; 
             // check wrap
             if (f > m) f = m;
-            memcpy(p, &_b[r], f);
-            _r = _inc(r, f);
+            memcpy(p, &_b[r], f * sizeof(T));
+            if (!_commit(r, _inc(r, f)))
+                continue; // lossy: evicted while copying, try again
             c -= f;
             p += f;
         }
         return n - c;
     }
     
+    /** get the available elements in place without copying them out of
+        the pipe. The data is returned as up to two contiguous regions, the
+        second region is only used if the data wraps at the end of the buffer.
+        The elements stay in the pipe until they are released with consume().
+        \param p0 set to the start of the first region
+        \param n0 set to the number of elements in the first region
+        \param p1 set to the start of the second region
+        \param n1 set to the number of elements in the second region
+        \return the number of elements available (n0 + n1)
+    */
+    int peek(const T*& p0, int& n0, const T*& p1, int& n1)
+    {
+        int r = _rd();
+        _pr = r;
+        return _spans(r, _avail(_s, r), p0, n0, p1, n1);
+    }
+
+    /** release elements that were inspected using peek()
+        \param n the number of elements to release, this must not be more
+                 than the number returned by peek()
+        \return true if successful, false if the elements were evicted
+                after peek() (lossy mode), what was inspected is invalid
+    */
+    bool consume(int n)
+    {
+        int r = _lossy ? _pr : _own(_r);
+        return _commit(r, _inc(r, n));
+    }
+
+    /** remove the oldest elements without reading them, e.g. data that
+        is known to be invalid. Unlike consume() this needs no peek(), in
+        lossy mode elements the writer evicts meanwhile count as removed.
+        \param n the number of elements to remove
+        \return the number of elements removed, less if fewer are available
+    */
+    int drop(int n)
+    {
+        int r = _rd();
+        int c = 0;
+        for (;;)
+        {
+            int f = _avail(n, r);
+            if (f > n) f = n;
+            if (_commit(r, _inc(r, f)))
+                return c + f;
+            // lossy: the writer evicted the oldest elements meanwhile
+            int e = (_rd() - r) & _m;
+            r = _inc(r, e);
+            c += (e < n) ? e : n;
+            n -= (e < n) ? e : n;
+        }
+    }
+
+    /** wait until the pipe is readable, the caller is parked on the
+        signal given to attach() or spins if there is none.
+        \return true if readable, false if the timeout expired
+    */
+    bool waitReadable(void)
+    {
+        while (!readable())
+            if (!_park(false, _tmo)) return false;
+        _waited(false);
+        return true;
+    }
+
     // the following functions are useful if you like to inspect 
-    // or parse the buffer in the reading thread/context
+    // or parse the buffer in the reading thread/context, they use
+    // the pipe's own Cursor, more can be created (see Cursor)
     // --------------------------------------------------------
     
     /** set the parsing index and return the number of available 
@@ -211,10 +746,7 @@ public:
     */
     int set(int ix) 
     {
-        int sz = size();
-        ix = (ix > sz) ? sz : ix;
-        _o = _inc(_r, ix); 
-        return sz - ix;
+        return _c.set(ix);
     }
     
     /** get the next element from parsing position and increment parsing index
@@ -222,20 +754,259 @@ public:
     */
     T next(void)
     {
-        int o = _o;
-        T t = _b[o]; 
-        _o = _inc(o); 
-        return t; 
+        return _c.next();
     }
     
     /** commit the index, mark the current parsing index as consumed data.
+        \return true if successful, false if the parsed elements were evicted
+                (lossy mode), what was parsed is invalid
     */
-    void done(void) 
+    bool done(void)
     {
-        _r = _o; 
+        return _c.done();
     } 
 
 private:
+#ifdef PIPE_ATOMIC
+    typedef std::atomic<int> _Ix; //!< index shared between the contexts
+
+    //! load the index owned by the other context
+    static inline int _ld(const _Ix& i)  { return i.load(std::memory_order_acquire); }
+    //! load the index owned by the calling context
+    static inline int _own(const _Ix& i) { return i.load(std::memory_order_relaxed); }
+    //! publish an index to the other context
+    static inline void _st(_Ix& i, int v) { i.store(v, std::memory_order_release); }
+    //! publish an index if it still has the expected value
+    static inline bool _cas(_Ix& i, int e, int v) { return i.compare_exchange_strong(e, v, std::memory_order_acq_rel); }
+
+    typedef std::atomic<bool> _Fl; //!< waiting flag shared between the contexts
+
+    //! full barrier between publishing and checking the other side's flag
+    static inline void _fence(void) { std::atomic_thread_fence(std::memory_order_seq_cst); }
+    //! load a waiting flag
+    static inline bool _ldf(const _Fl& f) { return f.load(std::memory_order_relaxed); }
+    //! set or clear a waiting flag
+    static inline void _stf(_Fl& f, bool v) { f.store(v, std::memory_order_relaxed); }
+#else
+    typedef volatile int _Ix; //!< index shared between the contexts
+
+    //! load the index owned by the other context
+    static inline int _ld(const _Ix& i)  { int v = i; PIPE_FENCE(); return v; }
+    //! load the index owned by the calling context
+    static inline int _own(const _Ix& i) { return i; }
+    //! publish an index to the other context
+    static inline void _st(_Ix& i, int v) { PIPE_FENCE(); i = v; }
+ #ifdef PIPE_CAS
+    //! publish an index if it still has the expected value
+    static inline bool _cas(_Ix& i, int e, int v) { return PIPE_CAS(&i, e, v); }
+ #else
+    //! no lossy mode without compare and swap, so this is never called
+    static inline bool _cas(_Ix& i, int e, int v) { _st(i, v); return true; }
+ #endif
+
+    typedef volatile bool _Fl; //!< waiting flag shared between the contexts
+
+    //! full barrier between publishing and checking the other side's flag
+    static inline void _fence(void) { PIPE_FENCE(); }
+    //! load a waiting flag
+    static inline bool _ldf(const _Fl& f) { return f; }
+    //! set or clear a waiting flag
+    static inline void _stf(_Fl& f, bool v) { f = v; }
+#endif
+
+    /** park the calling context until the other context made progress.
+        The waiting flag is raised before the final check so that a
+        _wake() of the other context can not get lost.
+        \param wr true if called by the writer (waits for space),
+                  false if called by the reader (waits for data)
+        \param ms timeout in milliseconds, -1 waits forever
+        \return false if the timeout expired
+    */
+    bool _park(bool wr, int ms)
+    {
+#ifdef PIPE_STATS
+        if (!_tb[wr]) { // start of the wait
+            _tb[wr] = true;
+            _t0[wr] = PIPE_CLOCK_US();
+        }
+#endif
+        PipeSignal* s = wr ? _sw : _sr;
+        if (!s)
+            return true; // no signal, the caller spins
+        _Fl& f = wr ? _fw : _fr;
+        _stf(f, true);
+        _fence();
+        bool ok = ((wr ? _free(1) : _avail(1, _rd())) > 0) || s->wait(ms);
+        _stf(f, false);
+        if (!ok)
+            _waited(wr);
+        return ok;
+    }
+
+    /** end of a wait, add the time blocked since the first _park() to the
+        statistics (with PIPE_STATS only)
+        \param wr true if called by the writer, false if called by the reader
+    */
+    inline void _waited(bool wr)
+    {
+#ifdef PIPE_STATS
+        if (_tb[wr]) {
+            unsigned int us = PIPE_CLOCK_US() - _t0[wr] + _tus[wr];
+            _tus[wr] = us % 1000;
+            _st(_tw[wr], _own(_tw[wr]) + (int)(us / 1000));
+            _tb[wr] = false;
+        }
+#else
+        (void)wr;
+#endif
+    }
+
+    /** count elements published by the writer (with PIPE_STATS only)
+        \param w the new write index
+        \param n the number of elements published
+    */
+    inline void _added(int w, int n)
+    {
+#ifdef PIPE_STATS
+        _st(_ni, _own(_ni) + n);
+        int u = (w - _ld(_r)) & _m;
+        if (u > _own(_hw))
+            _st(_hw, u);
+#else
+        (void)w; (void)n;
+#endif
+    }
+
+    /** wake the other context if it is parked, called after publishing.
+        \param wr true if called by the writer, false if called by the reader
+    */
+    inline void _wake(bool wr)
+    {
+        PipeSignal* s = wr ? _sr : _sw;
+        if (s) {
+            _fence();
+            if (_ldf(wr ? _fr : _fw))
+                s->signal();
+        }
+    }
+
+    /** free elements as seen by the writer, the read index is only
+        fetched if the cached copy shows less than n elements.
+        \param n the number of elements the writer is interested in
+        \return the number of free elements
+    */
+    inline int _free(int n)
+    {
+        int w = _own(_w);
+        int s = (_rc - w - 1) & _m;
+        if (s < n) {
+            _rc = _ld(_r);
+            s = (_rc - w - 1) & _m;
+        }
+        return s;
+    }
+
+    /** available elements as seen by the reader, the write index is only
+        fetched if the cached copy shows less than n elements (or always in
+        lossy mode, where the read index may have passed the cached copy).
+        \param n the number of elements the reader is interested in
+        \param r the read index
+        \return the number of available elements
+    */
+    inline int _avail(int n, int r)
+    {
+        int s = (_wc - r) & _m;
+        if ((s < n) || _lossy) {
+            _wc = _ld(_w);
+            s = (_wc - r) & _m;
+        }
+        return s;
+    }
+
+    /** the read index as seen by the reader, in lossy mode the writer
+        moves it too
+        \return the read index
+    */
+    inline int _rd(void)
+    {
+        return _lossy ? _ld(_r) : _own(_r);
+    }
+
+    /** publish a new read index and wake the writer
+        \param r the read index the reader started from
+        \param v the new read index
+        \return false if the writer evicted elements meanwhile (lossy mode)
+    */
+    inline bool _commit(int r, int v)
+    {
+        if (!_lossy)
+            _st(_r, v);
+        else if (!_cas(_r, r, v))
+            return false;
+#ifdef PIPE_STATS
+        _st(_no, _own(_no) + ((v - r) & _m));
+#endif
+        _wake(false);
+        return true;
+    }
+
+    /** make room for n elements by removing the oldest elements, or the
+        oldest frames if there is a frame function (lossy mode, writer only)
+        \param n the number of free elements needed, at most _s - 1
+    */
+    void _evict(int n)
+    {
+        for (;;)
+        {
+            int r = _ld(_r);
+            int w = _own(_w);
+            int e = n - ((r - w - 1) & _m);
+            if (e <= 0) {
+                _rc = r;
+                return;
+            }
+            if (_frame) {
+                int sz = (w - r) & _m;
+                int o = 0;
+                while (o < e) {
+                    const T* p0;
+                    const T* p1;
+                    int n0, n1;
+                    _spans(_inc(r, o), sz - o, p0, n0, p1, n1);
+                    int l = _frame(p0, n0, p1, n1);
+                    o += (l > 0) ? l : sz;
+                }
+                e = (o > sz) ? sz : o;
+            }
+            if (_cas(_r, r, _inc(r, e))) {
+                _st(_ev, _own(_ev) + e);
+                _rc = _inc(r, e);
+                return;
+            }
+            // the reader moved meanwhile, check again
+        }
+    }
+
+    /** split a range of the buffer into up to two contiguous regions
+        \param i the index of the first element
+        \param n the number of elements
+        \param p0 set to the start of the first region
+        \param n0 set to the number of elements in the first region
+        \param p1 set to the start of the second region
+        \param n1 set to the number of elements in the second region
+        \return n
+    */
+    template <class P>
+    inline int _spans(int i, int n, P*& p0, int& n0, P*& p1, int& n1)
+    {
+        int m = _s - i;
+        p0 = &_b[i];
+        n0 = (n > m) ? m : n;
+        p1 = _b;
+        n1 = n - n0;
+        return n;
+    }
+
     /** increment the index
         \param i index to increment
         \param n the step to increment
@@ -243,18 +1014,56 @@ private:
     */
     inline int _inc(int i, int n = 1)
     {
-        i += n;
-        if (i >= _s)
-            i -= _s;
-        return i;
+        return (i + n) & _m;
     }
 
     T*            _b; //!< buffer
     T*            _a; //!< allocated buffer
     int           _s; //!< size of buffer (s - 1) elements can be stored
-    volatile int  _w; //!< write index 
-    volatile int  _r; //!< read index 
-    int           _o; //!< offest index used by parsing functions  
+    int           _m; //!< index mask (s - 1)
+    _Ix           _r; //!< read index (owned by the reader)
+    _Ix           _w; //!< write index (owned by the writer)
+    int           _rc; //!< writer's copy of the read index
+    int           _wc; //!< reader's copy of the write index
+    PipeSignal*   _sr; //!< signal the reader waits on
+    PipeSignal*   _sw; //!< signal the writer waits on
+    int           _tmo; //!< timeout of put() and get() in milliseconds
+    _Fl           _fr; //!< reader is parked
+    _Fl           _fw; //!< writer is parked
+    _Ix           _ev; //!< elements evicted (owned by the writer)
+    _Ix           _nd; //!< elements dropped by the writer (owned by the writer)
+    int           _pr; //!< read index at the last peek()
+    bool          _lossy; //!< the writer evicts instead of waiting
+    Frame         _frame; //!< frame function for evicting whole frames
+    Cursor        _c; //!< the cursor of set(), next() and done()
+#ifdef PIPE_STATS
+    _Ix           _hw; //!< high-water mark (owned by the writer)
+    _Ix           _ni; //!< elements written (owned by the writer)
+    _Ix           _no; //!< elements read (owned by the reader)
+    _Ix           _tw[2]; //!< milliseconds blocked, [0] reader, [1] writer (owned by each)
+    unsigned int  _t0[2]; //!< clock at the start of the current wait
+    unsigned int  _tus[2]; //!< microseconds blocked not yet counted in _tw
+    bool          _tb[2]; //!< a wait is being timed
+#endif
+};
+
+/** pipe with a compile time size, the buffer is part of the object so
+    no heap is used and a statically declared pipe lives in .bss.
+    It can be passed to everything that takes a Pipe<T>.
+*/
+template <class T, int N>
+class Pipe : public Pipe<T, 0>
+{
+public:
+    /** Constructor
+    */
+    Pipe(void) : Pipe<T, 0>(N, _d)
+    {
+    }
+
+private:
+    PIPE_STATIC_ASSERT((N > 1) && !(N & (N - 1)), "Pipe size must be a power of two");
+    T _d[N]; //!< the buffer
 };
 
 #endif
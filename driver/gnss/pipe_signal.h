@@ -0,0 +1,98 @@
+/* Copyright (c) 2017 Michael Ammann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PIPE_SIGNAL_H
+#define PIPE_SIGNAL_H
+
+#include "pipe.h"
+
+/* PipeEvent, a PipeSignal that parks the waiting context. With the mbed
+   RTOS it uses a semaphore that can be released from an interrupt, on a
+   C++11 host it uses a condition variable. Without either of them there
+   is no PipeEvent and the pipes keep spinning.
+*/
+#if defined(MBED_CONF_RTOS_PRESENT)
+
+#include "rtos.h"
+
+/** pipe signal based on a RTOS semaphore
+*/
+class PipeEvent : public PipeSignal
+{
+public:
+    //! Constructor
+    PipeEvent(void) : _sem(0) {}
+
+    virtual bool wait(int ms)
+    {
+        return _sem.wait((ms < 0) ? osWaitForever : (uint32_t)ms) > 0;
+    }
+
+    virtual void signal(void)
+    {
+        _sem.release();
+    }
+
+private:
+    rtos::Semaphore _sem; //!< the semaphore
+};
+
+#define PIPE_EVENT //!< PipeEvent is available
+
+#elif (__cplusplus >= 201103L)
+
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+/** pipe signal based on a condition variable (host builds)
+*/
+class PipeEvent : public PipeSignal
+{
+public:
+    //! Constructor
+    PipeEvent(void) : _set(false) {}
+
+    virtual bool wait(int ms)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        if (ms < 0)
+            _cv.wait(lock, [this] { return _set; });
+        else if (!_cv.wait_for(lock, std::chrono::milliseconds(ms), [this] { return _set; }))
+            return false;
+        _set = false;
+        return true;
+    }
+
+    virtual void signal(void)
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _set = true;
+        _cv.notify_one();
+    }
+
+private:
+    std::mutex _mtx;              //!< protects _set
+    std::condition_variable _cv;  //!< the condition variable
+    bool _set;                    //!< signalled and not yet consumed
+};
+
+#define PIPE_EVENT //!< PipeEvent is available
+
+#endif
+
+#endif
+
+// End Of File
@@ -15,11 +15,22 @@
 
 #include "serial_pipe.h"
 
-SerialPipe::SerialPipe(PinName tx, PinName rx, int baudrate, int rxSize, int txSize) :
+SerialPipe::SerialPipe(PinName tx, PinName rx, int baudrate, int rxSize, int txSize,
+                       char* rxBuf, char* txBuf) :
             _SerialPipeBase(tx, rx, baudrate),
-            _pipeRx( (rx!=NC) ? rxSize : 0), 
-            _pipeTx( (tx!=NC) ? txSize : 0)
+            _pipeRx( (rx!=NC) ? rxSize : 0, rxBuf),
+            _pipeTx( (tx!=NC) ? txSize : 0, txBuf),
+            _dmaBuf(NULL), _dmaSize(0), _dmaPos(0),
+            _txAsyncBuf(NULL), _txAsyncLen(0), _txAsyncSent(0), _txAsyncSig(NULL),
+            _txSig(NULL), _txMs(-1),
+            _rxSig(NULL), _rxTerm('\n'),
+            _rxCount(0), _rxByteUs(0), _rxStamps(NULL)
 {
+#if DEVICE_SERIAL_ASYNCH
+    _txDma = false;
+    _txDmaLen = 0;
+#endif
+    baud(baudrate);
     if (rx!=NC)
         attach(this, &SerialPipe::rxIrqBuf, RxIrq);
 }
@@ -28,16 +39,35 @@ SerialPipe::~SerialPipe(void)
 {
     attach(NULL, RxIrq);
     attach(NULL, TxIrq);
+    delete _rxStamps;
+}
+
+void SerialPipe::baud(int baudrate)
+{
+    _SerialPipeBase::baud(baudrate);
+    // a start bit, 8 data bits and a stop bit
+    _rxByteUs = (baudrate > 0) ? (10000000 / baudrate) : 0;
+}
+
+void SerialPipe::attachSignals(PipeSignal* rx, PipeSignal* tx, int ms)
+{
+    // only the thread side ever blocks: reading rx and writing tx
+    _pipeRx.attach(rx, NULL, ms);
+    _pipeTx.attach(NULL, tx, ms);
+    // also raised when the buffer of putAsync() is sent
+    _txSig = tx;
+    _txMs = ms;
 }
 
 // tx channel
 int SerialPipe::writeable(void)    
 {
-    return _pipeTx.free();
+    return _txAsyncSent ? 0 : _pipeTx.free();
 }
 
 int SerialPipe::putc(int c)    
 {
+    txAsyncWait(true);
     c = _pipeTx.putc(c);
     txStart();
     return c;
@@ -47,7 +77,7 @@ int SerialPipe::put(const void* buffer, int length, bool blocking)
 { 
     int count = length;
     const char* ptr = (const char*)buffer;
-    if (count)
+    if (count && txAsyncWait(blocking, _txMs))
     {
         do
         {
@@ -57,18 +87,124 @@ int SerialPipe::put(const void* buffer, int length, bool blocking)
                 count -= written;
                 txStart();
             }
-            else if (!blocking)
-                break;
-            /* nothing / just wait */;
+            else if (!blocking || !_pipeTx.waitWriteable())
+                break; // not blocking or timeout
         }
         while (count);
     }
     return (length - count);
 }
 
+int SerialPipe::put(const Pipe<char>::Seg* seg, int cnt, bool blocking)
+{
+    int length = 0;
+    for (int i = 0; i < cnt; i ++)
+        length += seg[i].n;
+    int count = txAsyncWait(blocking, _txMs) ? length : 0;
+    while (count)
+    {
+        int written = _pipeTx.put(seg, cnt, false, length - count);
+        if (written) {
+            count -= written;
+            txStart();
+        }
+        else if (!blocking || !_pipeTx.waitWriteable())
+            break; // not blocking or timeout
+    }
+    return (length - count);
+}
+
+bool SerialPipe::putAsync(const void* buffer, int length, Callback<void(int)> done)
+{
+    if (_txAsyncSent || (length <= 0))
+        return false;
+    _txAsyncCb = done;
+    _txAsyncSig = NULL;
+    _txAsyncBuf = (const char*)buffer;
+    _txAsyncLen = length;
+    _txAsyncSent = length; // the transmit interrupt takes over from here
+    txStart();
+    return true;
+}
+
+bool SerialPipe::putAsync(const void* buffer, int length, PipeSignal* done)
+{
+    if (_txAsyncSent || (length <= 0))
+        return false;
+    _txAsyncCb = Callback<void(int)>();
+    _txAsyncSig = done;
+    _txAsyncBuf = (const char*)buffer;
+    _txAsyncLen = length;
+    _txAsyncSent = length;
+    txStart();
+    return true;
+}
+
+bool SerialPipe::putAsyncBusy(void)
+{
+    return _txAsyncSent != 0;
+}
+
+bool SerialPipe::txEmpty(void)
+{
+#if DEVICE_SERIAL_ASYNCH
+    if (_txDmaLen)
+        return false;
+#endif
+    // size() leaves the reader caches of the tx interrupt alone
+    return !_txAsyncSent && (_pipeTx.size() == 0);
+}
+
+bool SerialPipe::txAsyncWait(bool blocking, int ms)
+{
+    // nothing may overtake the buffer of putAsync(), txAsyncDone() raises
+    // the tx signal when it is sent, without a signal this spins
+    while (_txAsyncSent)
+    {
+        if (!blocking)
+            return false;
+        PipeSignal* sig = _txSig;
+        if (sig && !sig->wait(ms))
+            return false; // timeout
+    }
+    return true;
+}
+
+bool SerialPipe::txRefill(void)
+{
+    int n = _txAsyncLen;
+    if (n)
+    {
+        n = _pipeTx.put(_txAsyncBuf, n, false);
+        _txAsyncBuf += n;
+        _txAsyncLen -= n;
+    }
+    return n > 0;
+}
+
+void SerialPipe::txAsyncDone(void)
+{
+    int sent = _txAsyncSent;
+    if (sent && !_txAsyncLen && !_pipeTx.readable())
+    {
+        // take the completion before releasing the next putAsync()
+        Callback<void(int)> cb = _txAsyncCb;
+        PipeSignal* sig = _txAsyncSig;
+        _txAsyncSent = 0;
+        if (cb)
+            cb(sent);
+        if (sig)
+            sig->signal();
+        // wake a writer parked in txAsyncWait()
+        if (_txSig && (_txSig != sig))
+            _txSig->signal();
+    }
+}
+
 void SerialPipe::txCopy(void)
 {
-    while (_SerialPipeBase::writeable() && _pipeTx.readable())
+    // the buffer of putAsync() is fed to the pipe when it runs empty
+    while (_SerialPipeBase::writeable() && (_pipeTx.readable() || txRefill()))
     {
         char c = _pipeTx.getc();
         _SerialPipeBase::_base_putc(c);
@@ -79,20 +215,77 @@ void SerialPipe::txIrqBuf(void)
 {
     txCopy();
     // detach tx isr if we are done 
-    if (!_pipeTx.readable())
+    if (!_pipeTx.readable() && !_txAsyncLen) {
         attach(NULL, TxIrq);
+        txAsyncDone();
+    }
 }
 
 void SerialPipe::txStart(void)
 {
+#if DEVICE_SERIAL_ASYNCH
+    if (_txDma) {
+        // the completion interrupt chains the transfers, only start
+        // one if it is idle
+        core_util_critical_section_enter();
+        if (!_txDmaLen)
+            txDmaStart();
+        core_util_critical_section_exit();
+        return;
+    }
+#endif
     // disable the tx isr to avoid interruption
     attach(NULL, TxIrq);
     txCopy();
     // attach the tx isr to handle the remaining data
-    if (_pipeTx.readable())
+    if (_pipeTx.readable() || _txAsyncLen)
         attach(this, &SerialPipe::txIrqBuf, TxIrq);
+    else
+        txAsyncDone();
+}
+
+#if DEVICE_SERIAL_ASYNCH
+void SerialPipe::txDma(bool on)
+{
+    attach(NULL, TxIrq);
+    set_dma_usage_tx(on ? DMA_USAGE_ALWAYS : DMA_USAGE_NEVER);
+    _txDma = on;
+    txStart();
+}
+
+void SerialPipe::txDmaStart(void)
+{
+    const char* p0;
+    const char* p1;
+    int n0, n1;
+    txRefill();
+    if (!_pipeTx.peek(p0, n0, p1, n1))
+        txAsyncDone();
+    else
+    {
+        _txDmaLen = n0;
+        if (write((const uint8_t*)p0, n0, callback(this, &SerialPipe::txDmaDone),
+                  SERIAL_EVENT_TX_COMPLETE))
+        {
+            // busy or not supported, send with the transmit interrupt so
+            // that what is in the pipe is not stuck
+            _txDmaLen = 0;
+            _txDma = false;
+            txStart();
+        }
+    }
 }
 
+void SerialPipe::txDmaDone(int event)
+{
+    (void)event;
+    // release what was sent and chain the next region
+    _pipeTx.consume(_txDmaLen);
+    _txDmaLen = 0;
+    txDmaStart();
+}
+#endif
+
 // rx channel
 int SerialPipe::readable(void)                      
 { 
@@ -111,15 +304,176 @@ int SerialPipe::get(void* buffer, int length, bool blocking)
     return _pipeRx.get((char*)buffer,length,blocking); 
 }
 
+#ifdef PIPE_STATS
+Pipe<char>::Stats SerialPipe::rxStats(void)
+{
+    return _pipeRx.stats();
+}
+
+Pipe<char>::Stats SerialPipe::txStats(void)
+{
+    return _pipeTx.stats();
+}
+#endif
+
+void SerialPipe::rxDma(char* buf, int size)
+{
+    attach(NULL, RxIrq);
+    _dmaPos = 0;
+    _dmaSize = buf ? size : 0;
+    _dmaBuf = buf;
+    if (!buf)
+        attach(this, &SerialPipe::rxIrqBuf, RxIrq);
+}
+
+void SerialPipe::rxDmaEvent(int pos)
+{
+    if (!_dmaBuf)
+        return;
+    if (pos >= _dmaSize)
+        pos = 0; // a full transfer, the DMA wrapped
+    // publish the bytes written since the last event, in two
+    // parts if the DMA wrapped meanwhile
+    while (_dmaPos != pos)
+    {
+        int end = (pos > _dmaPos) ? pos : _dmaSize;
+        rxPut(_dmaBuf + _dmaPos, end - _dmaPos);
+        _dmaPos = (end == _dmaSize) ? 0 : end;
+    }
+}
+
+int SerialPipe::rxOverflows(void)
+{
+    return _pipeRx.overflowed();
+}
+
+void SerialPipe::rxSignal(PipeSignal* sig, char term)
+{
+    // the receive interrupt must not see a half written terminator
+    core_util_critical_section_enter();
+    _rxTermCb = Callback<bool(char)>();
+    _rxTerm = term;
+    _rxSig = sig;
+    core_util_critical_section_exit();
+}
+
+void SerialPipe::rxSignal(PipeSignal* sig, Callback<bool(char)> term)
+{
+    // the receive interrupt must not see a half written predicate
+    core_util_critical_section_enter();
+    _rxTermCb = term;
+    _rxSig = sig;
+    core_util_critical_section_exit();
+}
+
+void SerialPipe::rxStamps(int size, const char* starts)
+{
+    // the receive interrupt completes before the old pipe is released
+    Pipe<Stamp>* stamps = _rxStamps;
+    _rxStamps = NULL;
+    delete stamps;
+    memset(_rxStarts, 0, sizeof(_rxStarts));
+    for (; starts && *starts; starts ++)
+        _rxStarts[(unsigned char)*starts >> 3] |= 1 << (*starts & 7);
+    if (size > 0)
+        _rxStamps = new Pipe<Stamp>(size);
+}
+
+unsigned int SerialPipe::rxPos(void)
+{
+    // the count and the size have to be taken between two interrupts
+    unsigned int count;
+    int size;
+    do {
+        count = _rxCount;
+        size = _pipeRx.size();
+    } while (count != _rxCount);
+    return count - size;
+}
+
+bool SerialPipe::rxStamp(unsigned int pos, unsigned int& us)
+{
+    Pipe<Stamp>* stamps = _rxStamps;
+    const Stamp* p0;
+    const Stamp* p1;
+    int n0, n1;
+    while (stamps && stamps->peek(p0, n0, p1, n1))
+    {
+        int d = (int)(p0->pos - pos);
+        if (d > 0)
+            break; // not yet read
+        if (d == 0) {
+            // kept until a later byte is looked up, the same message
+            // may be looked at again (GnssSerial::peekMessage())
+            us = p0->us;
+            return true;
+        }
+        stamps->consume(1);
+    }
+    return false;
+}
+
+void SerialPipe::rxPut(const char* buf, int len)
+{
+    // a lossy pipe takes everything and drops the oldest data itself
+    int put = _pipeRx.put(buf, len, false);
+    if (put < len)
+        _pipeRx.overflow(len - put);
+    // the time is taken once per burst with a start byte, the start
+    // bytes are dated back by the bytes received after them
+    Pipe<Stamp>* stamps = _rxStamps;
+    if (stamps)
+    {
+        unsigned int now = 0;
+        bool clock = false;
+        for (int i = 0; i < put; i ++)
+        {
+            if (_rxStarts[(unsigned char)buf[i] >> 3] & (1 << (buf[i] & 7)))
+            {
+                if (!clock) {
+                    now = PIPE_CLOCK_US();
+                    clock = true;
+                }
+                Stamp s;
+                s.pos = _rxCount + i;
+                s.us = now - (len - 1 - i) * _rxByteUs;
+                stamps->put(&s, 1, false);
+            }
+        }
+    }
+    _rxCount += put;
+    // wake up the reader once per burst that completes a frame, the
+    // predicate sees every byte so that it can keep its state
+    PipeSignal* sig = _rxSig;
+    if (sig)
+    {
+        bool term = false;
+        if (_rxTermCb) {
+            for (int i = 0; i < len; i ++)
+                term = _rxTermCb(buf[i]) || term;
+        }
+        else
+            term = (memchr(buf, _rxTerm, len) != NULL);
+        if (term)
+            sig->signal();
+    }
+}
+
 void SerialPipe::rxIrqBuf(void)
 {
+    // drain the hardware into a local burst and publish the write
+    // index once per burst instead of once per byte
+    char buf[SERIAL_PIPE_RX_BURST];
+    int n = 0;
     while (_SerialPipeBase::readable())
     {
-        char c = _SerialPipeBase::_base_getc();
-        if (_pipeRx.writeable())
-            _pipeRx.putc(c);
-        else 
-            /* overflow */;
+        buf[n++] = _SerialPipeBase::_base_getc();
+        if (n == sizeof(buf)) {
+            rxPut(buf, n);
+            n = 0;
+        }
     }
+    if (n)
+        rxPut(buf, n);
 }
 
@@ -19,25 +19,68 @@
 #include "mbed.h"
 #include "pipe.h"
 
-#define _SerialPipeBase SerialBase //!< base class used by this class
+/* The byte transport SerialPipe derives from. Any class with the
+   interface of mbed's SerialBase that SerialPipe uses (readable(),
+   writeable(), attach() of the RxIrq and TxIrq handlers, _base_getc(),
+   _base_putc() and baud(), plus set_dma_usage_tx() and write() with
+   DEVICE_SERIAL_ASYNCH) can be used by defining _SerialPipeBase, its
+   declaration has to be visible through mbed.h or a header given with
+   the -include option of the compiler. On a Linux host the
+   SerialBase of host/mbed.h connects to a pseudo-terminal, a socket or
+   a capture file instead of a UART, see host/sim_wire.h.
+*/
+#ifndef _SerialPipeBase
+ #define _SerialPipeBase SerialBase //!< base class used by this class
+#endif
+
+#ifndef SERIAL_PIPE_RX_BURST
+ #define SERIAL_PIPE_RX_BURST 16 //!< bytes the rx interrupt collects before publishing, e.g. the UART FIFO depth
+#endif
 
 /** Buffered serial interface (rtos capable/interrupt driven)
 */
 class SerialPipe : public _SerialPipeBase
 {
 public:
+    //! receive timestamp of a frame start
+    struct Stamp {
+        unsigned int pos; //!< position of the byte in the received stream
+        unsigned int us;  //!< time it was received, see PIPE_CLOCK_US()
+    };
+
     /** Constructor
         \param tx the trasmitting pin
         \param rx the receiving pin
         \param baudate the serial baud rate
         \param rxSize the size of the receiving buffer
         \param txSize the size of the transmitting buffer
+        \param rxBuf optional buffer of rxSize bytes for the receiving pipe,
+               if NULL the buffer is allocated.
+        \param txBuf optional buffer of txSize bytes for the transmitting pipe,
+               if NULL the buffer is allocated.
     */
-    SerialPipe(PinName tx, PinName rx, int baudrate, int rxSize = 128, int txSize = 128);
+    SerialPipe(PinName tx, PinName rx, int baudrate, int rxSize = 128, int txSize = 128,
+               char* rxBuf = NULL, char* txBuf = NULL);
     
     /** Destructor
     */
     virtual ~SerialPipe(void);
+
+    /** park callers of the blocking functions on signals instead of
+        spinning, e.g. on a PipeEvent from pipe_signal.h.
+        \param rx signal raised by the receive interrupt when data arrived,
+               NULL to spin in the blocking receive functions
+        \param tx signal raised by the transmit interrupt when space got free,
+               NULL to spin in the blocking transmit functions
+        \param ms timeout of the blocking put() and get() in milliseconds,
+               -1 to wait forever
+    */
+    void attachSignals(PipeSignal* rx, PipeSignal* tx, int ms = -1);
+
+    /** set the baud rate, also used to date back the receive timestamps
+        \param baudrate the serial baud rate
+    */
+    void baud(int baudrate);
     
     // tx channel
     //----------------------------------------------------
@@ -61,7 +104,65 @@ public:
         \return the number of bytes written 
     */
     int put(const void* buffer, int length, bool blocking);
+
+    /** send several buffers (scatter-gather), e.g. the header, payload
+        and trailer of a message. What fits into the buffer is added at
+        once and the transmission is started once, so there is no gap
+        on the wire between the segments.
+        \param seg the segments to send
+        \param cnt the number of segments
+        \param blocking, if true this function will block
+               until all bytes placed in the buffer.
+        \return the number of bytes written
+    */
+    int put(const Pipe<char>::Seg* seg, int cnt, bool blocking);
     
+    /** send a buffer without waiting. The buffer is queued and fed to the
+        transmit pipe from the transmit interrupt, so it has to stay valid
+        until the completion is reported, which happens when its last byte
+        was handed to the UART. Until then put() and putc() wait (or return
+        0 if not blocking) so that the order of the bytes is kept.
+        \param buffer the buffer to send
+        \param length the size of the buffer to send
+        \param done called with the length when the buffer is sent, from
+               the transmit interrupt (or the calling thread if it is sent
+               at once)
+        \return false if another buffer is still being sent or length is 0
+    */
+    bool putAsync(const void* buffer, int length, Callback<void(int)> done);
+
+    /** send a buffer without waiting, see above.
+        \param buffer the buffer to send
+        \param length the size of the buffer to send
+        \param done signalled when the buffer is sent, e.g. a PipeEvent,
+               or NULL
+        \return false if another buffer is still being sent or length is 0
+    */
+    bool putAsync(const void* buffer, int length, PipeSignal* done = NULL);
+
+    /** check if a buffer given to putAsync() is still being sent
+        \return true if busy
+    */
+    bool putAsyncBusy(void);
+
+    /** check if everything was handed to the UART, e.g. before changing
+        the baud rate; the UART may still be sending its last bytes.
+        \return true if nothing is waiting to be sent
+    */
+    bool txEmpty(void);
+
+#if DEVICE_SERIAL_ASYNCH
+    /** transmit with DMA instead of an interrupt per byte. Each transfer
+        covers the largest contiguous readable region of the transmit
+        pipe, the next one is started from its completion. put() and
+        putc() are used as before. Switch only while nothing is sent.
+        If a transfer can not be started, e.g. because the target does
+        not support it, the interrupt per byte is used from then on.
+        \param on true to use DMA, false for an interrupt per byte
+    */
+    void txDma(bool on);
+#endif
+
     // rx channel
     //----------------------------------------------------
     
@@ -84,17 +185,134 @@ public:
     */
     int get(void* buffer, int length, bool blocking);
     
+    /** receive through a circular DMA buffer instead of an interrupt per
+        byte. The DMA channel of the UART has to be set up by the target
+        code to write the received bytes circularly to buf and to call
+        rxDmaEvent() from its idle-line, half and full transfer interrupts,
+        which publish whole bursts to the receive pipe. As the DMA does not
+        wait for the pipe, events must come at least every size bytes.
+        \param buf the circular DMA buffer, NULL to go back to an interrupt
+               per byte
+        \param size the size of buf
+    */
+    void rxDma(char* buf, int size);
+
+    /** DMA event, to be called from the idle-line, half and full transfer
+        interrupts of the DMA channel set up with rxDma().
+        \param pos the index in the DMA buffer the next byte will be written
+               to (the buffer size minus the remaining transfer count)
+    */
+    void rxDmaEvent(int pos);
+
+    /** get the number of received bytes that were lost because the
+        receive pipe was full
+        \return the number of bytes lost
+    */
+    int rxOverflows(void);
+
+    /** wake up a reader thread when a complete frame has arrived instead
+        of letting it poll. The receive interrupt (or rxDmaEvent()) checks
+        each received burst for the terminator and signals once per burst
+        that contains one.
+        \param sig the signal raised, e.g. a PipeEvent, NULL to stop
+        \param term the byte that terminates a frame, e.g. '\n' for NMEA
+    */
+    void rxSignal(PipeSignal* sig, char term = '\n');
+
+    /** wake up a reader thread when a complete frame has arrived, see
+        above, with a terminator predicate. It is called from the receive
+        interrupt with each received byte in order, so it may keep state,
+        e.g. to find the end of a length-prefixed frame.
+        \param sig the signal raised, e.g. a PipeEvent, NULL to stop
+        \param term returns true if the byte completes a frame
+    */
+    void rxSignal(PipeSignal* sig, Callback<bool(char)> term);
+
+    /** record the time each frame start byte is received in a side
+        channel, e.g. to measure the latency of messages. The receive
+        interrupt takes the time once per burst and dates it back by the
+        bytes received after the start byte.
+        \param size the number of timestamps kept until rxStamp() takes
+               them, 0 to stop recording
+        \param starts the frame start bytes, e.g. "$\xB5" for NMEA and UBX
+    */
+    void rxStamps(int size, const char* starts);
+
+    /** get the position of the next byte to be read in the received
+        stream, to look up its timestamp with rxStamp()
+        \return the position
+    */
+    unsigned int rxPos(void);
+
+    /** get the timestamp of a frame start byte, older timestamps are
+        discarded. Only the reading context may call this.
+        \param pos the position of the byte, see rxPos()
+        \param us set to the time it was received
+        \return true if there is a timestamp for the byte
+    */
+    bool rxStamp(unsigned int pos, unsigned int& us);
+
+#ifdef PIPE_STATS
+    // statistics, e.g. to size the buffers
+    //----------------------------------------------------
+
+    /** get the statistics of the receiving buffer, drops are the bytes
+        lost because the buffer was full
+        \return the statistics
+    */
+    Pipe<char>::Stats rxStats(void);
+
+    /** get the statistics of the transmitting buffer
+        \return the statistics
+    */
+    Pipe<char>::Stats txStats(void);
+#endif
+
 protected:
     //! receive interrupt routine
     void rxIrqBuf(void);
+    //! publish received bytes to the receive pipe, count what does not fit
+    void rxPut(const char* buf, int len);
     //! transmit interrupt woutine 
     void txIrqBuf(void);
     //! start transmission helper
     void txStart(void);
     //! move bytes to hardware
     void txCopy(void);
+    //! feed the buffer of putAsync() to the transmit pipe, true if bytes were added
+    bool txRefill(void);
+    //! report the completion of putAsync() once all of it left the transmit pipe
+    void txAsyncDone(void);
+    //! wait until the buffer of putAsync() is sent, parked on the tx signal if
+    //! there is one, false if not blocking and busy or on timeout (ms, -1 forever)
+    bool txAsyncWait(bool blocking, int ms = -1);
+#if DEVICE_SERIAL_ASYNCH
+    //! start a DMA transfer of the next contiguous region if there is data
+    void txDmaStart(void);
+    //! DMA transfer complete interrupt
+    void txDmaDone(int event);
+    bool _txDma;               //!< transmit with DMA
+    volatile int _txDmaLen;    //!< bytes of the DMA transfer in progress
+#endif
     Pipe<char> _pipeRx; //!< receive pipe
     Pipe<char> _pipeTx; //!< transmit pipe
+    char* _dmaBuf;  //!< circular receive DMA buffer, NULL if not used
+    int   _dmaSize; //!< size of the receive DMA buffer
+    int   _dmaPos;  //!< index in the DMA buffer published up to
+    const char* volatile _txAsyncBuf; //!< the rest of the putAsync() buffer
+    volatile int _txAsyncLen;         //!< bytes of the putAsync() buffer not yet in the pipe
+    volatile int _txAsyncSent;        //!< length of the putAsync() buffer, 0 if none
+    Callback<void(int)> _txAsyncCb;   //!< completion callback of putAsync()
+    PipeSignal* _txAsyncSig;          //!< completion signal of putAsync()
+    PipeSignal* _txSig;               //!< signal the blocking transmit functions wait on, NULL if none
+    int _txMs;                        //!< timeout of the blocking put() in milliseconds, -1 if none
+    PipeSignal* volatile _rxSig;      //!< signal raised when a frame is complete, NULL if none
+    char _rxTerm;                     //!< the terminating byte, if there is no predicate
+    Callback<bool(char)> _rxTermCb;   //!< the terminator predicate
+    volatile unsigned int _rxCount;   //!< bytes added to the receive pipe ever
+    int _rxByteUs;                    //!< time to receive a byte in microseconds
+    Pipe<Stamp>* volatile _rxStamps;  //!< timestamps of the frame starts, NULL if not recorded
+    unsigned char _rxStarts[32];      //!< bit set of the frame start bytes
 };
 
 #endif